@@ -0,0 +1,270 @@
+/*
+ * Merkle tree benchmarks on the host.
+ *
+ * Reports hashing rates for the message sizes the tree hashes, build time
+ * for 2^4 up to 2^max leaves, proof creation and verification latency
+ * percentiles, and allocator calls for each. Results are printed and also
+ * written as JSON (bench_merkle.json by default) so runs can be compared.
+ *
+ * usage: bench_merkle [-n max_log2] [-o out.json]
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "merkle.h"
+#include "sha256.h"
+
+#define MIN_LOG2 4
+#define PROOF_LOG2 16
+#define PROOF_SAMPLES 20000
+#define MIN_SECONDS 0.2
+#define PARALLEL_THREADS 4 // Used for the parallel build on a single-CPU host
+
+/*
+ * Allocation counting, the Makefile links with --wrap for these
+ */
+static size_t num_allocs;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t n, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+void* __wrap_malloc(size_t size) { num_allocs++; return __real_malloc(size); }
+void* __wrap_calloc(size_t n, size_t size) { num_allocs++; return __real_calloc(n, size); }
+void* __wrap_realloc(void* ptr, size_t size) { num_allocs++; return __real_realloc(ptr, size); }
+
+/*
+ * Helpers
+ */
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ull;
+
+static uint64_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static leaf* random_leafs(size_t n) {
+    leaf* leafs = malloc(n * sizeof(leaf));
+    if (leafs == NULL) return NULL;
+    for (size_t i = 0; i < n; i++) {
+        for (size_t b = 0; b < LEAF_SIZE; b += 8) {
+            uint64_t r = rng();
+            memcpy((char *) &leafs[i] + b, &r, LEAF_SIZE - b < 8 ? LEAF_SIZE - b : 8);
+        }
+        leafs[i].vote = rng() & 1;
+    }
+    return leafs;
+}
+
+static int compare_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*) a, y = *(const uint64_t*) b;
+    return (x > y) - (x < y);
+}
+
+typedef struct {
+    uint64_t p50, p90, p99, p999, max;
+} percentiles;
+
+static percentiles summarize(uint64_t* samples, size_t n) {
+    qsort(samples, n, sizeof(uint64_t), compare_u64);
+    percentiles p = {
+        samples[n * 50 / 100], samples[n * 90 / 100], samples[n * 99 / 100],
+        samples[n * 999 / 1000], samples[n - 1]
+    };
+    return p;
+}
+
+static uint64_t elapsed_ns(struct timespec* start, struct timespec* end) {
+    return (uint64_t) (end->tv_sec - start->tv_sec) * 1000000000ull + end->tv_nsec - start->tv_nsec;
+}
+
+/*
+ * Hash rates
+ */
+typedef struct {
+    const char* name;
+    double hashes_per_sec;
+} hash_result;
+
+static double rate(void (*op)(char*, char*), char* in, char* out) {
+    size_t rounds = 0;
+    double start = now(), elapsed;
+    do {
+        for (int i = 0; i < 1000; i++) {
+            op(in, out);
+        }
+        rounds += 1000;
+    } while ((elapsed = now() - start) < MIN_SECONDS);
+    return rounds / elapsed;
+}
+
+static void sha256_pair(char* in, char* out) { SHA256(in, NODE_SIZE * 2, out); }
+static void sha256_leaf(char* in, char* out) { SHA256(in, LEAF_SIZE, out); }
+static void leaf_node(char* in, char* out) { leaf_to_node((leaf *) in, (node *) out); }
+static void node_pair(char* in, char* out) { combine_nodes((node *) in, (node *) in + 1, (node *) out); }
+
+/*
+ * Main
+ */
+int main(int argc, char** argv) {
+    unsigned int max_log2 = 24;
+    const char* json_path = "bench_merkle.json";
+    int opt;
+    while ((opt = getopt(argc, argv, "n:o:")) != -1) {
+        if (opt == 'n') max_log2 = atoi(optarg);
+        else if (opt == 'o') json_path = optarg;
+        else {
+            fprintf(stderr, "usage: %s [-n max_log2] [-o out.json]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (max_log2 < MIN_LOG2 || max_log2 > MERKLE_MAX_HEIGHT) {
+        fprintf(stderr, "max_log2 must be between %d and %d\n", MIN_LOG2, MERKLE_MAX_HEIGHT);
+        return 1;
+    }
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads < 1) threads = 1;
+    // The parallel build always runs, so its root is checked on every host
+    long build_threads = threads > 1 ? threads : PARALLEL_THREADS;
+
+    FILE* json = fopen(json_path, "w");
+    if (json == NULL) {
+        perror(json_path);
+        return 1;
+    }
+
+    leaf* leafs = random_leafs((size_t) 1 << max_log2);
+    if (leafs == NULL) {
+        fprintf(stderr, "cannot allocate 2^%u leaves\n", max_log2);
+        return 1;
+    }
+    // build lazily initialized state outside the measurements
+    get_empty_node(0);
+    const char* backend = sha256_get_backend()->name;
+    fprintf(json, "{\n  \"backend\": \"%s\",\n  \"threads\": %ld,\n", backend, threads);
+    printf("backend %s, %ld threads\n\n", backend, threads);
+
+    // hashing
+    hash_result hashes[] = {
+        { "sha256_node_pair", 0 }, { "sha256_97B", 0 }, { "leaf_to_node", 0 }, { "combine_nodes", 0 }
+    };
+    void (*ops[])(char*, char*) = { sha256_pair, sha256_leaf, leaf_node, node_pair };
+    char in[LEAF_SIZE * 2], out[NODE_SIZE];
+    memcpy(in, leafs, sizeof(in));
+    fprintf(json, "  \"hash\": [\n");
+    printf("%-16s %14s\n", "hash", "hashes/s");
+    for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+        hashes[i].hashes_per_sec = rate(ops[i], in, out);
+        printf("%-16s %14.0f\n", hashes[i].name, hashes[i].hashes_per_sec);
+        fprintf(json, "    { \"name\": \"%s\", \"hashes_per_sec\": %.0f }%s\n", hashes[i].name,
+                hashes[i].hashes_per_sec, i + 1 < sizeof(ops) / sizeof(ops[0]) ? "," : "");
+    }
+
+    // tree builds, repeated so small trees still run for a measurable time.
+    // Every parallel root must match the serial one.
+    fprintf(json, "  ],\n  \"build\": [\n");
+    printf("\n%-10s %8s %12s %14s %8s\n", "build", "threads", "ms", "leaves/s", "allocs");
+    size_t root_mismatches = 0;
+    for (unsigned int log2 = MIN_LOG2; log2 <= max_log2; log2++) {
+        size_t n = (size_t) 1 << log2;
+        node serial_root;
+        for (int parallel = 0; parallel <= 1; parallel++) {
+            double best = 0;
+            size_t allocs = 0;
+            double start = now();
+            size_t runs = 0;
+            do {
+                size_t before = num_allocs;
+                double t = now();
+                vote_merkle* merkle = parallel ? create_merkle_tree_parallel(leafs, n, build_threads)
+                                               : create_merkle_tree(leafs, n);
+                t = now() - t;
+                allocs = num_allocs - before;
+                if (!parallel) memcpy(&serial_root, merkle_root(merkle), NODE_SIZE);
+                else if (memcmp(merkle_root(merkle), &serial_root, NODE_SIZE) != 0) root_mismatches++;
+                free_merkle_tree(merkle);
+                if (runs++ == 0 || t < best) best = t;
+            } while (now() - start < MIN_SECONDS);
+
+            long used = parallel ? build_threads : 1;
+            printf("2^%-8u %8ld %12.3f %14.0f %8zu\n", log2, used, best * 1e3, n / best, allocs);
+            fprintf(json, "    { \"leaves\": %zu, \"threads\": %ld, \"ms\": %.3f, \"leaves_per_sec\": %.0f, \"allocs\": %zu }%s\n",
+                    n, used, best * 1e3, n / best, allocs, log2 < max_log2 || parallel == 0 ? "," : "");
+        }
+    }
+
+    if (root_mismatches) {
+        fprintf(stderr, "%zu parallel builds gave a different root from create_merkle_tree\n", root_mismatches);
+        return 1;
+    }
+
+    // proof latency on one tree, random leaves
+    unsigned int proof_log2 = max_log2 < PROOF_LOG2 ? max_log2 : PROOF_LOG2;
+    size_t n = (size_t) 1 << proof_log2;
+    vote_merkle* merkle = create_merkle_tree(leafs, n);
+    uint64_t* create_ns = malloc(PROOF_SAMPLES * sizeof(uint64_t));
+    uint64_t* verify_ns = malloc(PROOF_SAMPLES * sizeof(uint64_t));
+    size_t create_allocs = 0, verify_allocs = 0, failures = 0;
+    for (size_t i = 0; i < PROOF_SAMPLES; i++) {
+        size_t index = rng() % n;
+        struct timespec a, b, c;
+        size_t before = num_allocs;
+        clock_gettime(CLOCK_MONOTONIC, &a);
+        node* proof = create_merkle_proof(merkle, index);
+        clock_gettime(CLOCK_MONOTONIC, &b);
+        create_allocs += num_allocs - before;
+        before = num_allocs;
+        bool valid = verify_merkle_proof(merkle_root(merkle), proof, get_merkle_node(merkle, 0, index), index, merkle->height);
+        clock_gettime(CLOCK_MONOTONIC, &c);
+        verify_allocs += num_allocs - before;
+        failures += !valid;
+        create_ns[i] = elapsed_ns(&a, &b);
+        verify_ns[i] = elapsed_ns(&b, &c);
+        free(proof);
+    }
+    free_merkle_tree(merkle);
+    if (failures) {
+        fprintf(stderr, "%zu proofs failed to verify\n", failures);
+        return 1;
+    }
+
+    percentiles create_p = summarize(create_ns, PROOF_SAMPLES);
+    percentiles verify_p = summarize(verify_ns, PROOF_SAMPLES);
+    printf("\nproofs on 2^%u leaves, ns  %8s %8s %8s %8s %8s %8s\n", proof_log2, "p50", "p90", "p99", "p99.9", "max", "allocs");
+    printf("%-26s %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8.2f\n", "create_merkle_proof", create_p.p50, create_p.p90,
+           create_p.p99, create_p.p999, create_p.max, (double) create_allocs / PROOF_SAMPLES);
+    printf("%-26s %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8.2f\n", "verify_merkle_proof", verify_p.p50, verify_p.p90,
+           verify_p.p99, verify_p.p999, verify_p.max, (double) verify_allocs / PROOF_SAMPLES);
+
+    fprintf(json, "  ],\n  \"proof\": {\n    \"leaves\": %zu,\n    \"samples\": %d,\n", n, PROOF_SAMPLES);
+    const char* names[] = { "create", "verify" };
+    percentiles* ps[] = { &create_p, &verify_p };
+    size_t allocs[] = { create_allocs, verify_allocs };
+    for (int i = 0; i < 2; i++) {
+        fprintf(json, "    \"%s_ns\": { \"p50\": %" PRIu64 ", \"p90\": %" PRIu64 ", \"p99\": %" PRIu64 ", \"p999\": %" PRIu64 ", \"max\": %" PRIu64 " },\n",
+                names[i], ps[i]->p50, ps[i]->p90, ps[i]->p99, ps[i]->p999, ps[i]->max);
+        fprintf(json, "    \"%s_allocs_per_call\": %.2f%s\n", names[i], (double) allocs[i] / PROOF_SAMPLES, i == 0 ? "," : "");
+    }
+    fprintf(json, "  }\n}\n");
+
+    free(create_ns);
+    free(verify_ns);
+    free(leafs);
+    fclose(json);
+    printf("\nwrote %s\n", json_path);
+    return 0;
+}
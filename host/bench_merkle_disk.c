@@ -0,0 +1,154 @@
+/*
+ * Out-of-core Merkle tree builder on the host.
+ *
+ * Writes random leaves to a file and times build_disk_merkle_tree on it for
+ * 2^4 up to 2^max leaves, and one leaf more for each. Every build is checked
+ * against create_merkle_tree on the same leaves: the root, the proofs of
+ * every leaf of small trees and of sampled leaves otherwise, and that the
+ * leaf past the end has no proof.
+ *
+ * usage: bench_merkle_disk [-n max_log2] [prefix]
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "merkle.h"
+#include "merkle_disk.h"
+
+#define MIN_LOG2 4
+#define PROOF_SAMPLES 1000
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ull;
+
+static uint64_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static leaf* random_leafs(size_t n) {
+    leaf* leafs = malloc(n * sizeof(leaf));
+    if (leafs == NULL) return NULL;
+    for (size_t i = 0; i < n; i++) {
+        for (size_t b = 0; b < LEAF_SIZE; b += 8) {
+            uint64_t r = rng();
+            memcpy((char *) &leafs[i] + b, &r, LEAF_SIZE - b < 8 ? LEAF_SIZE - b : 8);
+        }
+        leafs[i].vote = rng() % MERKLE_CANDIDATES;
+    }
+    return leafs;
+}
+
+static bool write_leafs(const char* path, leaf* leafs, size_t n) {
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) return false;
+    bool ok = fwrite(leafs, LEAF_SIZE, n, file) == n;
+    return fclose(file) == 0 && ok;
+}
+
+static void remove_segments(const char* prefix, unsigned int height) {
+    char path[strlen(prefix) + sizeof(".level") + 3];
+    for (unsigned int level = 0; level <= height; level++) {
+        snprintf(path, sizeof(path), "%s.level%u", prefix, level);
+        unlink(path);
+    }
+}
+
+static bool same_proof(disk_merkle* disk, vote_merkle* merkle, size_t index) {
+    node* expected = create_merkle_proof(merkle, index);
+    node* proof = create_disk_merkle_proof(disk, index);
+    bool same = proof != NULL && (merkle->height == 0 || (expected != NULL && memcmp(proof, expected, NODE_SIZE * merkle->height) == 0));
+    free(expected);
+    free(proof);
+    return same;
+}
+
+// Number of proofs that differ, or n if the trees don't match at all
+static size_t check_tree(disk_merkle* disk, vote_merkle* merkle, size_t n) {
+    node root;
+    if (disk->height != merkle->height || disk->num_leafs != n || !disk_merkle_root(disk, &root)
+            || memcmp(&root, merkle_root(merkle), NODE_SIZE) != 0) {
+        return n;
+    }
+
+    size_t failures = 0;
+    if (n <= PROOF_SAMPLES) {
+        for (size_t i = 0; i < n; i++) failures += !same_proof(disk, merkle, i);
+    } else {
+        for (size_t i = 0; i < PROOF_SAMPLES; i++) failures += !same_proof(disk, merkle, rng() % n);
+        failures += !same_proof(disk, merkle, n - 1);
+    }
+    node* past_end = create_disk_merkle_proof(disk, n);
+    if (past_end != NULL) failures++;
+    free(past_end);
+    return failures;
+}
+
+int main(int argc, char** argv) {
+    unsigned int max_log2 = 20;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        if (opt == 'n') max_log2 = atoi(optarg);
+        else {
+            fprintf(stderr, "usage: %s [-n max_log2] [prefix]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (max_log2 < MIN_LOG2 || max_log2 >= MERKLE_MAX_HEIGHT) {
+        fprintf(stderr, "max_log2 must be between %d and %d\n", MIN_LOG2, MERKLE_MAX_HEIGHT - 1);
+        return 1;
+    }
+    const char* prefix = optind < argc ? argv[optind] : "bench_merkle_disk.tmp";
+    char leaf_path[strlen(prefix) + sizeof(".leafs")];
+    snprintf(leaf_path, sizeof(leaf_path), "%s.leafs", prefix);
+
+    size_t max_leafs = ((size_t) 1 << max_log2) + 1;
+    leaf* leafs = random_leafs(max_leafs);
+    if (leafs == NULL) {
+        fprintf(stderr, "cannot allocate %zu leaves\n", max_leafs);
+        return 1;
+    }
+
+    size_t failures = 0;
+    printf("%12s %12s %14s\n", "leaves", "ms", "leaves/s");
+    for (unsigned int log2 = MIN_LOG2; log2 <= max_log2; log2++) {
+        for (size_t extra = 0; extra <= 1; extra++) {
+            size_t n = ((size_t) 1 << log2) + extra;
+            if (!write_leafs(leaf_path, leafs, n)) {
+                perror(leaf_path);
+                return 1;
+            }
+            double t = now();
+            disk_merkle* disk = build_disk_merkle_tree(leaf_path, prefix);
+            t = now() - t;
+            if (disk == NULL) {
+                fprintf(stderr, "cannot build a tree of %zu leaves at %s\n", n, prefix);
+                return 1;
+            }
+            printf("%12zu %12.3f %14.0f\n", n, t * 1e3, n / t);
+
+            vote_merkle* merkle = create_merkle_tree(leafs, n);
+            size_t wrong = check_tree(disk, merkle, n);
+            if (wrong) fprintf(stderr, "%zu leaves: %zu mismatches against create_merkle_tree\n", n, wrong);
+            failures += wrong;
+            remove_segments(prefix, disk->height);
+            close_disk_merkle_tree(disk);
+            free_merkle_tree(merkle);
+        }
+    }
+    unlink(leaf_path);
+    free(leafs);
+    return failures != 0;
+}
@@ -0,0 +1,2 @@
+// Host build stand-in for the libpi header of the same name
+#include <stdio.h>
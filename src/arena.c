@@ -0,0 +1,76 @@
+#include "arena.h"
+#include "malloc.h"
+
+#define ARENA_ALIGN 8
+#define align_up(n) (((n) + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1))
+
+struct arena_block {
+    arena_block * next;
+    size_t size;
+    size_t used;
+    // data follows the header, which is padded to ARENA_ALIGN
+};
+
+#define block_data(block) ((char *) (block) + align_up(sizeof(arena_block)))
+
+void arena_init(arena * a, size_t block_size) {
+    a->first = NULL;
+    a->current = NULL;
+    a->block_size = block_size;
+}
+
+// Links a new block after the current one, ahead of any blocks kept by
+// arena_reset that haven't been reached yet
+static arena_block * add_block(arena * a, size_t size) {
+    size_t data_size = size > a->block_size ? size : a->block_size;
+    arena_block * block = malloc(align_up(sizeof(arena_block)) + data_size);
+    if (block == NULL) return NULL;
+    block->size = data_size;
+    block->used = 0;
+    if (a->current == NULL) {
+        block->next = a->first;
+        a->first = block;
+    } else {
+        block->next = a->current->next;
+        a->current->next = block;
+    }
+    a->current = block;
+    return block;
+}
+
+void * arena_alloc(arena * a, size_t size) {
+    size = align_up(size);
+    arena_block * block = a->current;
+    if (block == NULL && a->first != NULL) {
+        // first allocation since a reset
+        block = a->current = a->first;
+        block->used = 0;
+    }
+    while (block == NULL || block->size - block->used < size) {
+        if (block != NULL && block->next != NULL && block->next->size >= size) {
+            block = a->current = block->next;
+            block->used = 0;
+        } else {
+            block = add_block(a, size);
+            if (block == NULL) return NULL;
+        }
+    }
+    void * ptr = block_data(block) + block->used;
+    block->used += size;
+    return ptr;
+}
+
+void arena_reset(arena * a) {
+    a->current = NULL;
+}
+
+void arena_release(arena * a) {
+    arena_block * block = a->first;
+    while (block != NULL) {
+        arena_block * next = block->next;
+        free(block);
+        block = next;
+    }
+    a->first = NULL;
+    a->current = NULL;
+}
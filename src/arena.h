@@ -0,0 +1,32 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/*
+ * Bump allocator over a list of blocks. Everything allocated from an arena
+ * is released at once by arena_reset, which keeps the blocks for reuse, so
+ * an arena's memory stays at its high-water mark instead of fragmenting the
+ * heap.
+ */
+
+typedef struct arena_block arena_block;
+
+typedef struct {
+    arena_block * first;
+    arena_block * current; // Block allocations are bumped from
+    size_t block_size; // Size of each new block, larger requests get their own
+} arena;
+
+void arena_init(arena * a, size_t block_size);
+
+// Returns size bytes aligned to 8, or NULL if a new block can't be malloc'd
+void * arena_alloc(arena * a, size_t size);
+
+// Frees every allocation, keeping the blocks
+void arena_reset(arena * a);
+
+// Returns the blocks to malloc
+void arena_release(arena * a);
+
+#endif
@@ -0,0 +1,100 @@
+#include "cert_index.h"
+#include "malloc.h"
+
+/*
+ * Chained hash table over the leaves. Certificates are hash output, so the
+ * prefix bytes are already uniform and serve as the hash directly.
+ */
+
+#define INITIAL_BUCKETS 64
+
+static unsigned int cert_key(const char * cert_bytes) {
+    unsigned int key = 0;
+    for (int i = 0; i < CERT_PREFIX_BYTES; i++) {
+        key = (key << 8) | (unsigned char) cert_bytes[i];
+    }
+    return key;
+}
+
+void cert_index_init(cert_index * index) {
+    index->buckets = NULL;
+    index->next = NULL;
+    index->keys = NULL;
+    index->num_buckets = 0;
+    index->num_leafs = 0;
+}
+
+// Doubles the bucket count and relinks every leaf
+static bool grow_buckets(cert_index * index) {
+    size_t num_buckets = index->num_buckets ? index->num_buckets * 2 : INITIAL_BUCKETS;
+    int * buckets = malloc(num_buckets * sizeof(int));
+    int * next = realloc(index->next, num_buckets * sizeof(int));
+    unsigned int * keys = realloc(index->keys, num_buckets * sizeof(unsigned int));
+    if (buckets == NULL || next == NULL || keys == NULL) {
+        free(buckets);
+        if (next) index->next = next;
+        if (keys) index->keys = keys;
+        return false;
+    }
+
+    for (size_t i = 0; i < num_buckets; i++) {
+        buckets[i] = -1;
+    }
+    for (size_t leaf = 0; leaf < index->num_leafs; leaf++) {
+        size_t bucket = keys[leaf] & (num_buckets - 1);
+        next[leaf] = buckets[bucket];
+        buckets[bucket] = leaf;
+    }
+
+    free(index->buckets);
+    index->buckets = buckets;
+    index->next = next;
+    index->keys = keys;
+    index->num_buckets = num_buckets;
+    return true;
+}
+
+// Keeps at most one leaf per bucket on average
+bool cert_index_reserve(cert_index * index, size_t num_leafs) {
+    while (index->num_buckets < num_leafs) {
+        if (!grow_buckets(index)) return false;
+    }
+    return true;
+}
+
+bool cert_index_add(cert_index * index, const char * cert_bytes) {
+    if (!cert_index_reserve(index, index->num_leafs + 1)) return false;
+
+    size_t leaf = index->num_leafs++;
+    unsigned int key = cert_key(cert_bytes);
+    size_t bucket = key & (index->num_buckets - 1);
+    index->keys[leaf] = key;
+    index->next[leaf] = index->buckets[bucket];
+    index->buckets[bucket] = leaf;
+    return true;
+}
+
+size_t cert_index_find(cert_index * index, const char * cert_bytes, int * matches, size_t max_matches) {
+    if (index->num_buckets == 0) return 0;
+
+    unsigned int key = cert_key(cert_bytes);
+    int head = index->buckets[key & (index->num_buckets - 1)];
+    size_t found = 0;
+    for (int leaf = head; leaf != -1; leaf = index->next[leaf]) {
+        if (index->keys[leaf] == key) found++;
+    }
+
+    // chains run from the newest leaf to the oldest, so fill matches from the
+    // back and skip the newest leaves that don't fit
+    size_t stored = found < max_matches ? found : max_matches;
+    size_t skip = found - stored;
+    for (int leaf = head; leaf != -1 && stored > 0; leaf = index->next[leaf]) {
+        if (index->keys[leaf] != key) continue;
+        if (skip > 0) {
+            skip--;
+        } else {
+            matches[--stored] = leaf;
+        }
+    }
+    return found;
+}
@@ -0,0 +1,35 @@
+#ifndef CERT_INDEX_H
+#define CERT_INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Index from certificate to leaf. A certificate is the first
+ * CERT_PREFIX_BYTES bytes of a leaf node's hash, so different leaves can
+ * share one and a lookup returns every candidate.
+ */
+
+#define CERT_PREFIX_BYTES 3
+
+typedef struct {
+    int * buckets; // First leaf in each bucket, -1 if empty
+    int * next; // Next leaf in the same bucket, -1 at the end
+    unsigned int * keys; // Certificate of each leaf
+    size_t num_buckets; // Always a power of two
+    size_t num_leafs;
+} cert_index;
+
+void cert_index_init(cert_index * index);
+
+// Makes room for num_leafs leaves, so adding up to that many can't fail
+bool cert_index_reserve(cert_index * index, size_t num_leafs);
+
+// Records the certificate of the next leaf, leaves are added in order
+bool cert_index_add(cert_index * index, const char * cert_bytes);
+
+// Writes up to max_matches leaves with this certificate to matches, lowest
+// leaf first, and returns how many leaves match in total
+size_t cert_index_find(cert_index * index, const char * cert_bytes, int * matches, size_t max_matches);
+
+#endif
@@ -140,10 +140,10 @@ key_event_t keyboard_read_event(void)
 
 #define is_lower_alpha(x) (x >= 97 && x <= 122)
 
-key_out_t keyboard_read_next(void)
+key_out_t keyboard_read_key(void)
 {
     key_event_t kd_event;
-    // Wait until receive a keydown event 
+    // Wait until receive a keydown event or a key is released
     while (1) {
         kd_event = keyboard_read_event();
         if (kd_event.action.what == KEY_PRESS && !keys_active[kd_event.action.keycode]) {
@@ -152,11 +152,14 @@ key_out_t keyboard_read_next(void)
         }
         else if (kd_event.action.what == KEY_RELEASE) {
             keys_active[kd_event.action.keycode] = false; 
+            break;
         }
     }
 
     key_out_t key_out;
     key_out.time = kd_event.time;
+    key_out.keycode = kd_event.action.keycode;
+    key_out.release = kd_event.action.what == KEY_RELEASE;
 
     // If Shift pressed, return upper
     if (kd_event.modifiers & KEYBOARD_MOD_SHIFT) {
@@ -172,3 +175,13 @@ key_out_t keyboard_read_next(void)
     }
     return key_out;
 }
+
+key_out_t keyboard_read_next(void)
+{
+    key_out_t key_out;
+    // Skip releases
+    do {
+        key_out = keyboard_read_key();
+    } while (key_out.release);
+    return key_out;
+}
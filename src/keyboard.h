@@ -1,6 +1,7 @@
 #ifndef KEYBOARD_H
 #define KEYBOARD_H
 
+#include <stdbool.h>
 #include "gpio.h"
 #include "ps2_keys.h"
 
@@ -50,6 +51,8 @@ typedef struct {
 
 typedef struct {
     unsigned char elem;
+    unsigned char keycode;              // ps2 key, matches a release to its press
+    bool release;                       // only set by keyboard_read_key
     unsigned int time;
 } key_out_t;
 
@@ -86,6 +89,17 @@ void keyboard_init(unsigned int clock_gpio, unsigned int data_gpio);
  */
 key_out_t keyboard_read_next(void);
 
+/*
+ * `keyboard_read_key`: Top level interface with key releases.
+ *
+ * Like `keyboard_read_next`, but also returns when a key is released, with
+ * `release` set. Holding a key down returns its press once, not a press
+ * for every repeat, so each press is followed by exactly one release.
+ *
+ * @return      key_out_t for the press or release, elem as for keyboard_read_next
+ */
+key_out_t keyboard_read_key(void);
+
 /*
  * `keyboard_read_event`: Mid level keyboard interface.
  *
@@ -0,0 +1,171 @@
+#include "keystroke.h"
+#include "strings.h"
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+void keystroke_default_config(keystroke_config * config) {
+    config->threshold = KEYSTROKE_THRESHOLD;
+    config->min_spread = KEYSTROKE_MIN_SPREAD;
+}
+
+uint16_t keystroke_interval(unsigned int elapsed_us) {
+    unsigned int ms = elapsed_us / 1000;
+    return ms > KEYSTROKE_MAX_INTERVAL ? KEYSTROKE_MAX_INTERVAL : ms;
+}
+
+void keystroke_stream_init(keystroke_stream * stream) {
+    memset(stream, 0, sizeof(keystroke_stream));
+}
+
+void keystroke_stream_press(keystroke_stream * stream, unsigned char keycode, unsigned int time) {
+    size_t key = stream->num_keys;
+    if (key >= KEYSTROKE_KEYS) return;
+
+    if (key > 0) {
+        stream->features[key - 1] = keystroke_interval(time - stream->press_time[key - 1]);
+    }
+    stream->press_time[key] = time;
+    stream->keycode[key] = keycode;
+    stream->held |= 1u << key;
+    stream->num_keys++;
+}
+
+void keystroke_stream_release(keystroke_stream * stream, unsigned char keycode, unsigned int time) {
+    // A key can only be held once, so at most one held key matches
+    for (size_t key = 0; key < stream->num_keys; key++) {
+        if ((stream->held >> key & 1) && stream->keycode[key] == keycode) {
+            stream->features[KEYSTROKE_DWELL(key)] = keystroke_interval(time - stream->press_time[key]);
+            stream->held &= ~(1u << key);
+            return;
+        }
+    }
+}
+
+void keystroke_stream_finish(keystroke_stream * stream, unsigned int time) {
+    for (size_t key = 0; key < stream->num_keys; key++) {
+        if (stream->held >> key & 1) {
+            stream->features[KEYSTROKE_DWELL(key)] = keystroke_interval(time - stream->press_time[key]);
+        }
+    }
+    stream->held = 0;
+}
+
+void keystroke_enroll_init(keystroke_enrollment * enrollment) {
+    memset(enrollment, 0, sizeof(keystroke_enrollment));
+}
+
+// Features past num_keys are 0 in every sample, so summing all of them
+// keeps their means and deviations 0
+bool keystroke_enroll_add(keystroke_enrollment * enrollment, const keystroke_stream * sample) {
+    if (enrollment->num_samples == 0) {
+        enrollment->num_keys = sample->num_keys;
+    } else if (sample->num_keys != enrollment->num_keys) {
+        return false;
+    }
+
+    for (size_t i = 0; i < KEYSTROKE_FEATURES; i++) {
+        uint16_t feature = sample->features[i];
+        enrollment->sum[i] += feature;
+        enrollment->sum_sq[i] += (uint64_t) feature * feature;
+    }
+    enrollment->num_samples++;
+    return true;
+}
+
+// Flights 0 to n - 2 and dwells 0 to n - 1 are scored
+static bool feature_used(size_t feature, size_t num_keys) {
+    if (feature >= KEYSTROKE_KEYS) return feature - KEYSTROKE_KEYS < num_keys;
+    return feature + 1 < num_keys;
+}
+
+static size_t num_features(size_t num_keys) {
+    return num_keys ? 2 * num_keys - 1 : 0;
+}
+
+static uint32_t isqrt(uint64_t n) {
+    uint64_t root = 0, bit = (uint64_t) 1 << 62;
+    while (bit > n) bit >>= 2;
+    while (bit != 0) {
+        if (n >= root + bit) {
+            n -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return root;
+}
+
+bool keystroke_enroll_finish(keystroke_enrollment * enrollment, const keystroke_config * config, keystroke_profile * profile) {
+    uint64_t n = enrollment->num_samples;
+    if (n == 0) return false;
+
+    memset(profile, 0, sizeof(keystroke_profile));
+    profile->num_keys = enrollment->num_keys;
+    uint32_t min_spread = config->min_spread < 2 ? 2 : config->min_spread;
+    for (size_t i = 0; i < KEYSTROKE_FEATURES; i++) {
+        if (!feature_used(i, enrollment->num_keys)) continue;
+        uint64_t sum = enrollment->sum[i];
+        // n^2 * variance = n * sum of squares - sum^2, exact in integers
+        uint32_t spread = isqrt(n * enrollment->sum_sq[i] - sum * sum) / n;
+        if (spread < min_spread) spread = min_spread;
+        profile->mean[i] = (sum + n / 2) / n;
+        profile->weight[i] = (1u << 16) / spread;
+    }
+    return true;
+}
+
+// Features the vector loops cover, the scalar loop does the rest
+#if defined(__ARM_NEON) || defined(__SSE2__)
+#define VECTOR_FEATURES (KEYSTROKE_FEATURES & ~7)
+#else
+#define VECTOR_FEATURES 0
+#endif
+
+// Each feature adds |time - mean| * weight >> 8, below 2^23, so the 32-bit
+// sums can't overflow. Eight features per step where the CPU has vectors.
+uint32_t keystroke_distance(const keystroke_profile * profile, const uint16_t * features) {
+    uint32_t total = 0;
+    size_t i = 0;
+#if defined(__ARM_NEON)
+    uint32x4_t acc = vdupq_n_u32(0);
+    for (; i < VECTOR_FEATURES; i += 8) {
+        uint16x8_t diff = vabdq_u16(vld1q_u16(&features[i]), vld1q_u16(&profile->mean[i]));
+        uint16x8_t weight = vld1q_u16(&profile->weight[i]);
+        acc = vaddq_u32(acc, vshrq_n_u32(vmull_u16(vget_low_u16(diff), vget_low_u16(weight)), 8));
+        acc = vaddq_u32(acc, vshrq_n_u32(vmull_u16(vget_high_u16(diff), vget_high_u16(weight)), 8));
+    }
+    total = vgetq_lane_u32(acc, 0) + vgetq_lane_u32(acc, 1) + vgetq_lane_u32(acc, 2) + vgetq_lane_u32(acc, 3);
+#elif defined(__SSE2__)
+    __m128i acc = _mm_setzero_si128();
+    for (; i < VECTOR_FEATURES; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i *) &features[i]);
+        __m128i mean = _mm_loadu_si128((const __m128i *) &profile->mean[i]);
+        __m128i weight = _mm_loadu_si128((const __m128i *) &profile->weight[i]);
+        __m128i diff = _mm_or_si128(_mm_subs_epu16(x, mean), _mm_subs_epu16(mean, x));
+        __m128i lo = _mm_mullo_epi16(diff, weight);
+        __m128i hi = _mm_mulhi_epu16(diff, weight);
+        acc = _mm_add_epi32(acc, _mm_srli_epi32(_mm_unpacklo_epi16(lo, hi), 8));
+        acc = _mm_add_epi32(acc, _mm_srli_epi32(_mm_unpackhi_epi16(lo, hi), 8));
+    }
+    uint32_t lanes[4];
+    _mm_storeu_si128((__m128i *) lanes, acc);
+    total = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+    for (i = VECTOR_FEATURES; i < KEYSTROKE_FEATURES; i++) {
+        uint32_t diff = features[i] > profile->mean[i] ? features[i] - profile->mean[i] : profile->mean[i] - features[i];
+        total += (diff * profile->weight[i]) >> 8;
+    }
+    size_t used = num_features(profile->num_keys);
+    return used ? total / used : 0;
+}
+
+bool keystroke_match(const keystroke_profile * profile, const keystroke_stream * attempt, const keystroke_config * config) {
+    if (attempt->num_keys != profile->num_keys) return false;
+    return keystroke_distance(profile, attempt->features) <= config->threshold;
+}
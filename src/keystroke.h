@@ -0,0 +1,96 @@
+#ifndef KEYSTROKE_H
+#define KEYSTROKE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Keystroke dynamics. Typing a phrase of n keys gives 2n - 1 features: the
+ * n - 1 flight times from one key press to the next, and the n dwell times
+ * each key is held down. A voter types their phrase several times when they
+ * register, and each feature gets a mean and a standard deviation. A later
+ * attempt is scored by the scaled Manhattan distance, the mean over features
+ * of |time - mean| / deviation, in fixed point with KEYSTROKE_FRAC_BITS
+ * fraction bits.
+ */
+
+#define KEYSTROKE_KEYS 32 // Keys timed per phrase
+#define KEYSTROKE_FEATURES (2 * KEYSTROKE_KEYS) // Flights, then dwells
+#define KEYSTROKE_DWELL(key) (KEYSTROKE_KEYS + (key)) // Index of a key's dwell
+#define KEYSTROKE_SAMPLES 3 // Times the phrase is typed to register
+#define KEYSTROKE_MAX_INTERVAL 0xffff // Times are milliseconds, clamped here
+#define KEYSTROKE_FRAC_BITS 8
+
+// Defaults for keystroke_config, override with -D
+#ifndef KEYSTROKE_THRESHOLD
+#define KEYSTROKE_THRESHOLD (2 << KEYSTROKE_FRAC_BITS) // Two deviations on average
+#endif
+#ifndef KEYSTROKE_MIN_SPREAD
+#define KEYSTROKE_MIN_SPREAD 30 // ms
+#endif
+
+typedef struct {
+    uint32_t threshold; // Largest accepted distance, fixed point
+    uint16_t min_spread; // Floor on a feature's deviation in ms, at least 2
+} keystroke_config;
+
+// Features of one typing of a phrase, filled in as key events arrive so
+// they're complete as soon as Enter is pressed
+typedef struct {
+    uint16_t features[KEYSTROKE_FEATURES]; // 0 where the phrase is shorter
+    unsigned int press_time[KEYSTROKE_KEYS];
+    unsigned char keycode[KEYSTROKE_KEYS];
+    uint32_t held; // Bit per key pressed but not yet released
+    uint16_t num_keys;
+} keystroke_stream;
+
+// Running sums while a voter registers
+typedef struct {
+    uint32_t sum[KEYSTROKE_FEATURES];
+    uint64_t sum_sq[KEYSTROKE_FEATURES];
+    uint16_t num_keys; // Keys in every sample
+    uint16_t num_samples;
+} keystroke_enrollment;
+
+// weight is 2^16 / deviation, and both are 0 for features past num_keys,
+// so the distance can run over every feature
+typedef struct {
+    uint16_t mean[KEYSTROKE_FEATURES];
+    uint16_t weight[KEYSTROKE_FEATURES];
+    uint16_t num_keys;
+} keystroke_profile;
+
+void keystroke_default_config(keystroke_config * config);
+
+// Converts the time between two key events to a stored interval
+uint16_t keystroke_interval(unsigned int elapsed_us);
+
+void keystroke_stream_init(keystroke_stream * stream);
+
+// Records a key of the phrase going down, keys past KEYSTROKE_KEYS are
+// ignored. Times are in microseconds.
+void keystroke_stream_press(keystroke_stream * stream, unsigned char keycode, unsigned int time);
+
+// Records a key coming up, releases of keys that aren't held are ignored
+void keystroke_stream_release(keystroke_stream * stream, unsigned char keycode, unsigned int time);
+
+// Ends the phrase at time, keys still held are taken as released then
+void keystroke_stream_finish(keystroke_stream * stream, unsigned int time);
+
+void keystroke_enroll_init(keystroke_enrollment * enrollment);
+
+// Adds one typing of the phrase. Fails if it has a different number of keys
+// than the samples before it.
+bool keystroke_enroll_add(keystroke_enrollment * enrollment, const keystroke_stream * sample);
+
+// Summarizes the samples added so far, needs at least one
+bool keystroke_enroll_finish(keystroke_enrollment * enrollment, const keystroke_config * config, keystroke_profile * profile);
+
+// Scaled Manhattan distance of one attempt from the profile. features holds
+// KEYSTROKE_FEATURES entries, the ones the profile doesn't use are ignored.
+uint32_t keystroke_distance(const keystroke_profile * profile, const uint16_t * features);
+
+bool keystroke_match(const keystroke_profile * profile, const keystroke_stream * attempt, const keystroke_config * config);
+
+#endif
@@ -0,0 +1,46 @@
+#include "leaf_store.h"
+#include "malloc.h"
+
+#define INITIAL_TABLE_SIZE 16
+
+void leaf_store_init(leaf_store * store) {
+    store->blocks = NULL;
+    store->num_blocks = 0;
+    store->table_size = 0;
+    store->num_leafs = 0;
+}
+
+// Only the table of block pointers is ever reallocated
+bool leaf_store_reserve(leaf_store * store, size_t num_leafs) {
+    while (store->num_blocks * LEAF_BLOCK_SIZE < num_leafs) {
+        if (store->num_blocks == store->table_size) {
+            size_t table_size = store->table_size ? store->table_size * 2 : INITIAL_TABLE_SIZE;
+            leaf ** blocks = realloc(store->blocks, table_size * sizeof(leaf *));
+            if (blocks == NULL) return false;
+            store->blocks = blocks;
+            store->table_size = table_size;
+        }
+
+        leaf * block = malloc(LEAF_BLOCK_SIZE * sizeof(leaf));
+        if (block == NULL) return false;
+        store->blocks[store->num_blocks++] = block;
+    }
+    return true;
+}
+
+leaf * leaf_store_append(leaf_store * store, const leaf * new_leaf) {
+    if (!leaf_store_reserve(store, store->num_leafs + 1)) return NULL;
+
+    leaf * slot = leaf_store_get(store, store->num_leafs);
+    *slot = *new_leaf;
+    store->num_leafs++;
+    return slot;
+}
+
+void leaf_store_free(leaf_store * store) {
+    for (size_t i = 0; i < store->num_blocks; i++) {
+        free(store->blocks[i]);
+    }
+    free(store->blocks);
+    leaf_store_init(store);
+}
@@ -0,0 +1,37 @@
+#ifndef LEAF_STORE_H
+#define LEAF_STORE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "merkle.h"
+
+/*
+ * Growable array of vote leaves. Leaves live in fixed-size blocks found
+ * through a block table, so growing only allocates a new block and never
+ * moves a leaf: pointers to leaves stay valid and indexing is a shift and
+ * a mask.
+ */
+
+#define LEAF_BLOCK_SHIFT 8
+#define LEAF_BLOCK_SIZE (1 << LEAF_BLOCK_SHIFT) // Leaves per block
+
+typedef struct {
+    leaf ** blocks; // Block table
+    size_t num_blocks; // Blocks allocated
+    size_t table_size; // Slots in the block table
+    size_t num_leafs;
+} leaf_store;
+
+#define leaf_store_get(store, index) (&(store)->blocks[(index) >> LEAF_BLOCK_SHIFT][(index) & (LEAF_BLOCK_SIZE - 1)])
+
+void leaf_store_init(leaf_store * store);
+
+// Allocates blocks until num_leafs leaves fit
+bool leaf_store_reserve(leaf_store * store, size_t num_leafs);
+
+// Copies new_leaf to the end, returns where it's kept or NULL if out of memory
+leaf * leaf_store_append(leaf_store * store, const leaf * new_leaf);
+
+void leaf_store_free(leaf_store * store);
+
+#endif
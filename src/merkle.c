@@ -1,3 +1,7 @@
+#ifdef MERKLE_MMAP
+#define _POSIX_C_SOURCE 200809L // fsync, fileno and mmap
+#endif
+
 #include "merkle.h"
 #include "strings.h"
 #include "sha256.h"
@@ -5,13 +9,17 @@
 #include "printf.h"
 #include <stdbool.h>
 
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 /*
  * Implementation of the Merkel Vote Tree
  * Each leaf contains: Hash of children | Vote Accumulator.
  */
 
-#define hexchar(x) x <= 9 ? '0' + x : 'a' + (x - 10)
-
 void SHA256(const char * data, size_t len, char * hash) {
 	SHA256_CTX ctx;
 	sha256_init(&ctx);
@@ -19,32 +27,111 @@ void SHA256(const char * data, size_t len, char * hash) {
 	sha256_final(&ctx, (BYTE *) hash);
 }
 
+// Leaves and node pairs are always hashed at the same length, so their
+// SHA-256 padding (0x80, zeros, then the bit length) is fixed per length.
+#define PADDED_BLOCKS(len) (((len) + 8) / 64 + 1)
+#define PAD_SIZE(len) (PADDED_BLOCKS(len) * 64 - (len))
+#define PAD_TEMPLATE(len) { \
+    0x80, \
+    [PAD_SIZE(len) - 4] = (((len) * 8) >> 24) & 0xff, \
+    [PAD_SIZE(len) - 3] = (((len) * 8) >> 16) & 0xff, \
+    [PAD_SIZE(len) - 2] = (((len) * 8) >> 8) & 0xff, \
+    [PAD_SIZE(len) - 1] = ((len) * 8) & 0xff, \
+}
+
+static const BYTE LEAF_PAD[PAD_SIZE(LEAF_SIZE)] = PAD_TEMPLATE(LEAF_SIZE);
+static const BYTE PAIR_PAD[PAD_SIZE(NODE_SIZE * 2)] = PAD_TEMPLATE(NODE_SIZE * 2);
+
+// Hashes len contiguous bytes with their prebuilt padding. Whole blocks are
+// compressed in place, only the trailing partial block is assembled.
+static void hash_fixed(const void * data, size_t len, const BYTE * pad, char * hash) {
+    BYTE tail[128];
+    size_t head_blocks = len / 64;
+    size_t rem = len % 64;
+    memcpy(tail, (const BYTE *) data + head_blocks * 64, rem);
+    memcpy(&tail[rem], pad, PAD_SIZE(len));
+    sha256_padded((const BYTE *) data, head_blocks, tail, PADDED_BLOCKS(len) - head_blocks, (BYTE *) hash);
+}
+
 // Turn a leaf into a node
 void leaf_to_node(leaf * leafsrc, node * newnode) {
-    SHA256((const char*) leafsrc, LEAF_SIZE, newnode->hash);
-    newnode->vote_count = leafsrc->vote;
+    hash_fixed(leafsrc, LEAF_SIZE, LEAF_PAD, newnode->hash);
+    set_leaf_votes(leafsrc, newnode);
+}
+
+// A leaf counts one vote for its candidate, a vote for a candidate that
+// isn't on the ballot counts for nobody
+void set_leaf_votes(leaf * leafsrc, node * newnode) {
+    memset(newnode->vote_count, 0, sizeof(newnode->vote_count));
+    unsigned char candidate = leafsrc->vote;
+    if (candidate < MERKLE_CANDIDATES) {
+        newnode->vote_count[candidate] = 1;
+    }
+}
+
+// Sums two count vectors, four candidates per vector add where the CPU has
+// them. parent may be either input.
+void add_vote_counts(node *left, node *right, node* parent) {
+    size_t i = 0;
+#if defined(__ARM_NEON)
+    for (; i + 4 <= MERKLE_CANDIDATES; i += 4) {
+        vst1q_u32(&parent->vote_count[i], vaddq_u32(vld1q_u32(&left->vote_count[i]), vld1q_u32(&right->vote_count[i])));
+    }
+#elif defined(__SSE2__)
+    for (; i + 4 <= MERKLE_CANDIDATES; i += 4) {
+        __m128i sum = _mm_add_epi32(_mm_loadu_si128((const __m128i *) &left->vote_count[i]),
+                                    _mm_loadu_si128((const __m128i *) &right->vote_count[i]));
+        _mm_storeu_si128((__m128i *) &parent->vote_count[i], sum);
+    }
+#endif
+    for (; i < MERKLE_CANDIDATES; i++) {
+        parent->vote_count[i] = left->vote_count[i] + right->vote_count[i];
+    }
+}
+
+// hex_pairs holds the two digits of every byte value and hex_values the
+// value of every character, -1 for anything that isn't a hex digit
+static char hex_pairs[256 * 2];
+static signed char hex_values[256];
+static bool hex_tables_ready = false;
+
+static void init_hex_tables(void) {
+    const char digits[] = "0123456789abcdef";
+    for (int i = 0; i < 256; i++) {
+        hex_pairs[2 * i] = digits[i >> 4];
+        hex_pairs[2 * i + 1] = digits[i & 0xf];
+        hex_values[i] = -1;
+    }
+    for (int i = 0; i < 16; i++) {
+        hex_values[(unsigned char) digits[i]] = i;
+        hex_values[(unsigned char) "0123456789ABCDEF"[i]] = i;
+    }
+    hex_tables_ready = true;
 }
 
+// Writes n bytes as 2n lowercase hex digits and a terminator
 void bytes_to_hex(char * bytes, char * buf, int n) {
-    size_t iter = 0;
-    size_t buf_iter = 0;
-    while (n--) {
-        char first_byte = bytes[iter] >> 4;
-        char second_byte = bytes[iter] & 0b1111;
-        buf[buf_iter++] = hexchar(first_byte);
-        buf[buf_iter++] = hexchar(second_byte);
-        iter++;
+    if (!hex_tables_ready) init_hex_tables();
+    const unsigned char * in = (const unsigned char *) bytes;
+    for (int i = 0; i < n; i++) {
+        memcpy(&buf[2 * i], &hex_pairs[2 * in[i]], 2);
     }
-    buf[buf_iter] = '\0';
+    buf[2 * n] = '\0';
 }
 
-// Convert hex to bytes
-void hex_to_bytes(const char * hex, char * buf, size_t n) {
-    for (int i = 0; i < n; i += 2) {
-        unsigned char first_hex = hex[i] >= 'a' ? 10 + (hex[i] - 'a') : hex[i] - '0';
-        unsigned char second_hex = hex[i + 1] >= 'a' ? 10 + (hex[i + 1] - 'a') : hex[i + 1] - '0';
-        buf[i / 2] = (first_hex << 4) + second_hex;
+// Decodes n hex digits of either case into n / 2 bytes. Returns false if n
+// is odd or a character isn't a hex digit, leaving buf partly written.
+bool hex_to_bytes(const char * hex, char * buf, size_t n) {
+    if (n % 2) return false;
+    if (!hex_tables_ready) init_hex_tables();
+    const unsigned char * in = (const unsigned char *) hex;
+    for (size_t i = 0; i < n; i += 2) {
+        int high = hex_values[in[i]];
+        int low = hex_values[in[i + 1]];
+        if ((high | low) < 0) return false;
+        buf[i / 2] = (high << 4) | low;
     }
+    return true;
 }
 
 void concat_nodes(node *left, node *right, char* buf, int buf_size) { memcpy(buf, left, NODE_SIZE);
@@ -53,57 +140,524 @@ void concat_nodes(node *left, node *right, char* buf, int buf_size) { memcpy(buf
 }
 
 void hash_nodes(node *left, node *right, char* hash) { 
-    char buf[NODE_SIZE * 2 + 1];
-    concat_nodes(left, right, buf, NODE_SIZE * 2 + 1); 
-    SHA256((const char *) buf, NODE_SIZE * 2, hash);
+    // siblings stored next to each other in a row are already one message
+    if (right == left + 1) {
+        hash_fixed(left, NODE_SIZE * 2, PAIR_PAD, hash);
+        return;
+    }
+
+    BYTE blocks[PADDED_BLOCKS(NODE_SIZE * 2) * 64];
+    memcpy(blocks, left, NODE_SIZE);
+    memcpy(&blocks[NODE_SIZE], right, NODE_SIZE);
+    memcpy(&blocks[NODE_SIZE * 2], PAIR_PAD, sizeof(PAIR_PAD));
+    sha256_padded(blocks, 0, blocks, PADDED_BLOCKS(NODE_SIZE * 2), (BYTE *) hash);
 }
 
 void combine_nodes(node *left, node *right, node* parent) {
     hash_nodes(left, right, parent->hash);
-    parent->vote_count = left->vote_count + right->vote_count;
+    add_vote_counts(left, right, parent);
 }
 
-#define left_child(i) 2 * i + 1
-#define right_child(i) 2 * i + 2
-#define parent(i) (i - 1) / 2
-#define is_right(i) i % 2 == 0
-
 // Used to fill spots in leaf of merkle tree
 const node EMPTY_NODE = {
     "00000000000000000000000000000000",
-    0
+    { 0 }
 };
 
-vote_merkle* create_merkle_tree(leaf* leafs, int num_leafs) {
-    // get depth of merkle tree
+// empty_nodes[level] is the root of a subtree of that height whose leaves are
+// all EMPTY_NODE, so padding is looked up here instead of stored or hashed.
+static node empty_nodes[MERKLE_EMPTY_LEVELS];
+static bool empty_nodes_ready = false;
+
+node* get_empty_node(unsigned int level) {
+    if (!empty_nodes_ready) {
+        memcpy(&empty_nodes[0], &EMPTY_NODE, NODE_SIZE);
+        for (unsigned int i = 0; i + 1 < MERKLE_EMPTY_LEVELS; i++) {
+            combine_nodes(&empty_nodes[i], &empty_nodes[i], &empty_nodes[i + 1]);
+        }
+        empty_nodes_ready = true;
+    }
+    return &empty_nodes[level];
+}
+
+// Nodes in row `level` above `n` leaves, rounding partial pairs up
+#define row_size(n, level) ((n) ? (((n) - 1) >> (level)) + 1 : 0)
+
+node* get_merkle_node(vote_merkle * merkle, unsigned int level, size_t index) {
+    if (index < row_size(merkle->num_leafs, level)) {
+        return &merkle->levels[level][index];
+    }
+    return get_empty_node(level);
+}
+
+// Messages handed to sha256_many per call while building a row
+#define HASH_BATCH 64
+
+// Hashes a run of leaves into their nodes, HASH_BATCH leaves at a time
+static void leafs_to_nodes(leaf* leafs, node* nodes, size_t n) {
+    const BYTE* msgs[HASH_BATCH];
+    BYTE* out[HASH_BATCH];
+    for (size_t start = 0; start < n; start += HASH_BATCH) {
+        size_t batch = (n - start < HASH_BATCH) ? n - start : HASH_BATCH;
+        for (size_t i = 0; i < batch; i++) {
+            msgs[i] = (const BYTE*) &leafs[start + i];
+            out[i] = (BYTE*) nodes[start + i].hash;
+            set_leaf_votes(&leafs[start + i], &nodes[start + i]);
+        }
+        sha256_many(msgs, LEAF_SIZE, out, batch);
+    }
+}
+
+// Fills a row from the one below it. Siblings sit next to each other in the
+// row below, so each parent hashes its 2 * NODE_SIZE bytes in place.
+static void combine_row(node* below, size_t below_size, node* row, unsigned int level) {
+    const BYTE* msgs[HASH_BATCH];
+    BYTE* out[HASH_BATCH];
+    size_t pairs = below_size / 2;
+    for (size_t start = 0; start < pairs; start += HASH_BATCH) {
+        size_t batch = (pairs - start < HASH_BATCH) ? pairs - start : HASH_BATCH;
+        for (size_t i = 0; i < batch; i++) {
+            node* left = &below[2 * (start + i)];
+            msgs[i] = (const BYTE*) left;
+            out[i] = (BYTE*) row[start + i].hash;
+            add_vote_counts(&left[0], &left[1], &row[start + i]);
+        }
+        sha256_many(msgs, NODE_SIZE * 2, out, batch);
+    }
+
+    // a trailing odd node pairs with an empty subtree
+    if (below_size % 2) {
+        combine_nodes(&below[below_size - 1], get_empty_node(level - 1), &row[pairs]);
+    }
+}
+
+// Depth of the smallest power-of-two tree holding num_leafs leaves
+static unsigned int tree_height(size_t num_leafs) {
     unsigned int height = 0;
-    unsigned int total_leafs = 1;
+    size_t total_leafs = 1;
     while(total_leafs < num_leafs) {
         total_leafs *= 2;
         height += 1;
     }
+    return height;
+}
 
-    // initiate merkle tree
-    vote_merkle* merkle = malloc(MERKLE_SIZE);
+// Allocates the rows for num_leafs leaves, only real nodes are stored
+vote_merkle* alloc_merkle_tree(size_t num_leafs) {
+    unsigned int height = tree_height(num_leafs);
+
+    vote_merkle* merkle = malloc(sizeof(vote_merkle));
     merkle->height = height;
-    merkle->nodes = malloc(NODE_SIZE * (total_leafs * 2  - 1));
+    merkle->num_leafs = num_leafs;
+    merkle->capacity = num_leafs;
+#ifdef MERKLE_MMAP
+    merkle->image = NULL;
+#endif
+    for (unsigned int level = 0; level <= MERKLE_MAX_HEIGHT; level++) {
+        merkle->levels[level] = num_leafs && level <= height ? malloc(NODE_SIZE * row_size(num_leafs, level)) : NULL;
+    }
+    return merkle;
+}
+
+size_t merkle_row_size(vote_merkle * merkle, unsigned int level) {
+    return row_size(merkle->num_leafs, level);
+}
+
+vote_merkle* create_merkle_tree(leaf* leafs, size_t num_leafs) {
+    vote_merkle* merkle = alloc_merkle_tree(num_leafs);
 
     // populate bottom row
-    node* bottom_nodes = &merkle->nodes[total_leafs - 1];
-    for (size_t i = 0; i < num_leafs; i++) {
-        leaf_to_node(&leafs[i], &bottom_nodes[i]);
+    leafs_to_nodes(leafs, merkle->levels[0], num_leafs);
+
+    // populate everything else a level at a time
+    for (unsigned int level = 1; level <= merkle->height; level++) {
+        combine_row(merkle->levels[level - 1], row_size(num_leafs, level - 1), merkle->levels[level], level);
+    }
+
+    return merkle;
+}
+
+// Carries a finished subtree up the stack like a binary counter: a set bit
+// `level` in num_leafs means pending[level] waits for its right sibling.
+static void push_stream_node(merkle_stream* stream, node* subtree) {
+    unsigned int level = 0;
+    while (stream->num_leafs >> level & 1) {
+        combine_nodes(&stream->pending[level], subtree, subtree);
+        level++;
     }
-    for (size_t i = num_leafs; i < total_leafs; i++) {
-        memcpy(&bottom_nodes[i], &EMPTY_NODE, NODE_SIZE);
+    memcpy(&stream->pending[level], subtree, NODE_SIZE);
+    stream->num_leafs++;
+}
+
+void merkle_stream_init(merkle_stream* stream) {
+    stream->num_leafs = 0;
+}
+
+bool merkle_stream_add(merkle_stream* stream, leaf* new_leaf) {
+    if (stream->num_leafs == (size_t) 1 << MERKLE_MAX_HEIGHT) return false;
+    node leaf_node;
+    leaf_to_node(new_leaf, &leaf_node);
+    push_stream_node(stream, &leaf_node);
+    return true;
+}
+
+// Same as adding each leaf in turn, but hashes HASH_BATCH leaves together
+bool merkle_stream_add_leafs(merkle_stream* stream, leaf* leafs, size_t num_leafs) {
+    if (num_leafs > ((size_t) 1 << MERKLE_MAX_HEIGHT) - stream->num_leafs) return false;
+    node nodes[HASH_BATCH];
+    for (size_t start = 0; start < num_leafs; start += HASH_BATCH) {
+        size_t batch = (num_leafs - start < HASH_BATCH) ? num_leafs - start : HASH_BATCH;
+        leafs_to_nodes(&leafs[start], nodes, batch);
+        for (size_t i = 0; i < batch; i++) {
+            push_stream_node(stream, &nodes[i]);
+        }
+    }
+    return true;
+}
+
+// Writes the root create_merkle_tree would give for the leaves added so far.
+// Subtrees still pending on the stack are closed off with empty siblings,
+// exactly as the padded tree pairs its trailing nodes.
+void merkle_stream_root(merkle_stream* stream, node* root) {
+    unsigned int height = tree_height(stream->num_leafs);
+    if (stream->num_leafs == 0) {
+        memcpy(root, get_empty_node(0), NODE_SIZE);
+        return;
+    }
+    if (stream->num_leafs == (size_t) 1 << height) {
+        // a full tree is a single finished subtree
+        memcpy(root, &stream->pending[height], NODE_SIZE);
+        return;
+    }
+
+    bool carrying = false;
+    for (unsigned int level = 0; level < height; level++) {
+        if (stream->num_leafs >> level & 1) {
+            combine_nodes(&stream->pending[level], carrying ? root : get_empty_node(level), root);
+            carrying = true;
+        } else if (carrying) {
+            combine_nodes(root, get_empty_node(level), root);
+        }
+    }
+}
+
+#ifdef MERKLE_THREADS
+#include <pthread.h>
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+// One worker's share of a parallel build: the subtree of the given height
+// whose leftmost leaf is first_leaf.
+typedef struct {
+    vote_merkle* merkle;
+    leaf* leafs;
+    size_t first_leaf;
+    unsigned int height;
+} subtree_job;
+
+// Builds one subtree bottom up. Subtrees cover disjoint, aligned ranges of
+// every row they touch, so workers write into the rows without locking.
+static void* build_subtree(void* arg) {
+    subtree_job* job = arg;
+    vote_merkle* merkle = job->merkle;
+    size_t width = (size_t) 1 << job->height;
+    size_t start = job->first_leaf;
+    if (start >= merkle->num_leafs) return NULL; // all padding
+
+    leafs_to_nodes(&job->leafs[start], &merkle->levels[0][start], min(width, merkle->num_leafs - start));
+    for (unsigned int level = 1; level <= job->height; level++) {
+        size_t below_start = start >> (level - 1);
+        size_t below_size = min(width >> (level - 1), row_size(merkle->num_leafs, level - 1) - below_start);
+        combine_row(&merkle->levels[level - 1][below_start], below_size, &merkle->levels[level][start >> level], level);
+    }
+    return NULL;
+}
+
+// Same tree as create_merkle_tree, built by up to num_threads threads. The
+// threads each take one of the largest power-of-two number of equal subtrees
+// and the calling thread combines their roots, so the result is identical
+// for any thread count.
+vote_merkle* create_merkle_tree_parallel(leaf* leafs, size_t num_leafs, unsigned int num_threads) {
+    vote_merkle* merkle = alloc_merkle_tree(num_leafs);
+
+    // levels above the subtree roots, built by the calling thread
+    unsigned int split = 0;
+    while (split < merkle->height && ((size_t) 2 << split) <= num_threads) {
+        split++;
+    }
+    size_t num_jobs = (size_t) 1 << split;
+    unsigned int sub_height = merkle->height - split;
+
+    // lazily built shared state has to exist before the workers read it
+    get_empty_node(0);
+    sha256_get_backend();
+
+    subtree_job* jobs = malloc(num_jobs * sizeof(subtree_job));
+    pthread_t* threads = malloc(num_jobs * sizeof(pthread_t));
+    bool* started = malloc(num_jobs * sizeof(bool));
+    for (size_t j = 0; j < num_jobs; j++) {
+        jobs[j].merkle = merkle;
+        jobs[j].leafs = leafs;
+        jobs[j].first_leaf = j << sub_height;
+        jobs[j].height = sub_height;
+        // the calling thread takes the first subtree itself
+        started[j] = j > 0 && pthread_create(&threads[j], NULL, build_subtree, &jobs[j]) == 0;
     }
+    for (size_t j = 0; j < num_jobs; j++) {
+        if (!started[j]) build_subtree(&jobs[j]);
+    }
+    for (size_t j = 0; j < num_jobs; j++) {
+        if (started[j]) pthread_join(threads[j], NULL);
+    }
+    free(jobs);
+    free(threads);
+    free(started);
 
-    // populate everything else 
-    for (int i = total_leafs - 2; i >= 0; i--) {
-        combine_nodes(&merkle->nodes[left_child(i)], &merkle->nodes[right_child(i)], &merkle->nodes[i]);
+    for (unsigned int level = sub_height + 1; level <= merkle->height; level++) {
+        combine_row(merkle->levels[level - 1], row_size(num_leafs, level - 1), merkle->levels[level], level);
     }
 
     return merkle;
 }
+#endif
+
+#ifdef MERKLE_MMAP
+#include <stdint.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Tree image file: a merkle_image_header, then the stored nodes of each row
+ * from the leaves up, then optionally the leaf records. Every section starts
+ * on a MERKLE_IMAGE_ALIGN boundary, and integers are in the byte order of
+ * the machine that wrote the file, which byte_order records.
+ */
+
+#define MERKLE_IMAGE_MAGIC "VMERKLE"
+#define MERKLE_IMAGE_VERSION 1
+#define MERKLE_IMAGE_BYTE_ORDER 0x01020304
+#define MERKLE_IMAGE_ALIGN 64
+
+#define image_align(offset) (((offset) + MERKLE_IMAGE_ALIGN - 1) & ~(uint64_t) (MERKLE_IMAGE_ALIGN - 1))
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t node_size; // NODE_SIZE and LEAF_SIZE when written
+    uint32_t leaf_size;
+    uint32_t height;
+    uint32_t reserved;
+    uint64_t num_leafs;
+    uint64_t num_records; // Leaf records, 0 or num_leafs
+    uint64_t records; // File offset of the leaf records
+    uint64_t rows[MERKLE_MAX_HEIGHT + 1]; // File offset of each row
+} merkle_image_header;
+
+// Copies the rows of a loaded tree out of its read-only mapping so they can
+// be written and grown
+static bool unmap_merkle_tree(vote_merkle * merkle) {
+    node* rows[MERKLE_MAX_HEIGHT + 1];
+    for (unsigned int level = 0; level <= merkle->height; level++) {
+        size_t size = NODE_SIZE * row_size(merkle->capacity, level);
+        rows[level] = NULL;
+        if (size == 0) continue;
+        rows[level] = malloc(size);
+        if (rows[level] == NULL) {
+            while (level--) free(rows[level]);
+            return false;
+        }
+        memcpy(rows[level], merkle->levels[level], NODE_SIZE * row_size(merkle->num_leafs, level));
+    }
+    for (unsigned int level = 0; level <= merkle->height; level++) {
+        merkle->levels[level] = rows[level];
+    }
+    munmap(merkle->image, merkle->image_size);
+    merkle->image = NULL;
+    return true;
+}
+
+// Pads the file with zeros up to offset, then writes len bytes of data
+static bool write_at(FILE* file, uint64_t* pos, uint64_t offset, const void* data, size_t len) {
+    static const char zeros[MERKLE_IMAGE_ALIGN];
+    while (*pos < offset) {
+        size_t pad = offset - *pos < sizeof(zeros) ? offset - *pos : sizeof(zeros);
+        if (fwrite(zeros, 1, pad, file) != pad) return false;
+        *pos += pad;
+    }
+    if (len && fwrite(data, 1, len, file) != len) return false;
+    *pos += len;
+    return true;
+}
+
+// Writes the tree, and the leaves it was built from unless leafs is NULL.
+// The image is written beside path and renamed over it, so a crash part way
+// through leaves any previous image intact.
+bool save_merkle_tree(vote_merkle * merkle, leaf* leafs, const char* path) {
+    merkle_image_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MERKLE_IMAGE_MAGIC, sizeof(header.magic));
+    header.version = MERKLE_IMAGE_VERSION;
+    header.byte_order = MERKLE_IMAGE_BYTE_ORDER;
+    header.node_size = NODE_SIZE;
+    header.leaf_size = LEAF_SIZE;
+    header.height = merkle->height;
+    header.num_leafs = merkle->num_leafs;
+    header.num_records = leafs ? merkle->num_leafs : 0;
+
+    uint64_t offset = image_align(sizeof(header));
+    for (unsigned int level = 0; level <= merkle->height; level++) {
+        header.rows[level] = offset;
+        offset = image_align(offset + NODE_SIZE * row_size(merkle->num_leafs, level));
+    }
+    header.records = offset;
+
+    char tmp_path[strlen(path) + sizeof(".tmp")];
+    memcpy(tmp_path, path, strlen(path));
+    memcpy(tmp_path + strlen(path), ".tmp", sizeof(".tmp"));
+
+    FILE* file = fopen(tmp_path, "wb");
+    if (file == NULL) return false;
+    uint64_t pos = 0;
+    bool ok = write_at(file, &pos, 0, &header, sizeof(header));
+    for (unsigned int level = 0; level <= merkle->height && ok; level++) {
+        ok = write_at(file, &pos, header.rows[level], merkle->levels[level], NODE_SIZE * row_size(merkle->num_leafs, level));
+    }
+    ok = ok && write_at(file, &pos, header.records, leafs, LEAF_SIZE * header.num_records);
+    ok = ok && fflush(file) == 0 && fsync(fileno(file)) == 0;
+    ok = fclose(file) == 0 && ok;
+    ok = ok && rename(tmp_path, path) == 0;
+    if (!ok) remove(tmp_path);
+    return ok;
+}
+
+static bool valid_image(const merkle_image_header* header, uint64_t size) {
+    if (!cmp(header->magic, MERKLE_IMAGE_MAGIC, sizeof(header->magic))
+            || header->version != MERKLE_IMAGE_VERSION
+            || header->byte_order != MERKLE_IMAGE_BYTE_ORDER
+            || header->node_size != NODE_SIZE || header->leaf_size != LEAF_SIZE
+            || header->height > MERKLE_MAX_HEIGHT
+            || header->num_leafs > (uint64_t) 1 << header->height
+            || tree_height(header->num_leafs) != header->height
+            || (header->num_records != 0 && header->num_records != header->num_leafs)) {
+        return false;
+    }
+    for (unsigned int level = 0; level <= header->height; level++) {
+        uint64_t offset = header->rows[level];
+        if (offset % MERKLE_IMAGE_ALIGN || offset > size
+                || size - offset < NODE_SIZE * row_size(header->num_leafs, level)) {
+            return false;
+        }
+    }
+    return header->records % MERKLE_IMAGE_ALIGN == 0 && header->records <= size
+        && size - header->records >= LEAF_SIZE * header->num_records;
+}
+
+// Maps an image written by save_merkle_tree. Its rows are served straight
+// from the mapping until the first append copies them out. If leafs isn't
+// NULL it is pointed at the saved leaf records, or NULL if there are none;
+// they stay valid until the tree is appended to or freed.
+vote_merkle* load_merkle_tree(const char* path, leaf** leafs) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    void* image = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t) st.st_size >= sizeof(merkle_image_header)) {
+        image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (image == MAP_FAILED) return NULL;
+
+    const merkle_image_header* header = image;
+    vote_merkle* merkle = valid_image(header, st.st_size) ? malloc(sizeof(vote_merkle)) : NULL;
+    if (merkle == NULL) {
+        munmap(image, st.st_size);
+        return NULL;
+    }
+    merkle->height = header->height;
+    merkle->num_leafs = header->num_leafs;
+    merkle->capacity = header->num_leafs;
+    merkle->image = image;
+    merkle->image_size = st.st_size;
+    for (unsigned int level = 0; level <= MERKLE_MAX_HEIGHT; level++) {
+        merkle->levels[level] = merkle->num_leafs && level <= merkle->height ? (node *) ((char *) image + header->rows[level]) : NULL;
+    }
+    if (leafs) {
+        *leafs = header->num_records ? (leaf *) ((char *) image + header->records) : NULL;
+    }
+    return merkle;
+}
+#endif
+
+// Doubles the number of leaf slots allocated. Rows are extended in place by
+// realloc, so nothing already in the tree is rehashed.
+static bool grow_merkle_tree(vote_merkle * merkle) {
+    size_t capacity = merkle->capacity ? merkle->capacity * 2 : 1;
+    for (unsigned int level = 0; level <= merkle->height; level++) {
+        node* row = realloc(merkle->levels[level], NODE_SIZE * row_size(capacity, level));
+        if (row == NULL) return false;
+        merkle->levels[level] = row;
+    }
+    merkle->capacity = capacity;
+    return true;
+}
+
+bool reserve_merkle_leaf(vote_merkle * merkle) {
+#ifdef MERKLE_MMAP
+    if (merkle->image && !unmap_merkle_tree(merkle)) return false;
+#endif
+    if (merkle->num_leafs == merkle->capacity && !grow_merkle_tree(merkle)) {
+        return false;
+    }
+
+    // a full tree needs a row for its new root
+    if (merkle->num_leafs == (size_t) 1 << merkle->height) {
+        if (merkle->height == MERKLE_MAX_HEIGHT) return false;
+        node** row = &merkle->levels[merkle->height + 1];
+        if (*row == NULL) *row = malloc(NODE_SIZE * row_size(merkle->capacity, merkle->height + 1));
+        if (*row == NULL) return false;
+    }
+    return true;
+}
+
+// Adds a leaf after the last appended one, rehashing only its path to the
+// root. Returns the new leaf node, or NULL if the tree could not grow.
+node* append_merkle_leaf(vote_merkle * merkle, leaf * new_leaf) {
+    if (!reserve_merkle_leaf(merkle)) return NULL;
+
+    // a full tree becomes the left subtree of a new root
+    if (merkle->num_leafs == (size_t) 1 << merkle->height) merkle->height++;
+
+    size_t index = merkle->num_leafs++;
+    node* leaf_node = &merkle->levels[0][index];
+    leaf_to_node(new_leaf, leaf_node);
+
+    for (unsigned int level = 1; level <= merkle->height; level++) {
+        index /= 2;
+        combine_nodes(get_merkle_node(merkle, level - 1, 2 * index),
+                      get_merkle_node(merkle, level - 1, 2 * index + 1),
+                      &merkle->levels[level][index]);
+    }
+
+    return leaf_node;
+}
+
+void free_merkle_tree(vote_merkle * merkle) {
+#ifdef MERKLE_MMAP
+    if (merkle->image) {
+        munmap(merkle->image, merkle->image_size);
+        free(merkle);
+        return;
+    }
+#endif
+    for (unsigned int level = 0; level <= MERKLE_MAX_HEIGHT; level++) {
+        free(merkle->levels[level]);
+    }
+    free(merkle);
+}
 
 void print_bytes(void * bytes, int len) {
     char hash_str[len * 2 + 1];
@@ -111,24 +665,52 @@ void print_bytes(void * bytes, int len) {
     printf("%s\n", hash_str);
 }
 
-node* create_merkle_proof(vote_merkle * merkle, size_t leaf_index) {
-    node *merkle_proof = malloc(NODE_SIZE * merkle->height);
-    int total_leafs = 1 << merkle->height;
-    size_t index = leaf_index + total_leafs - 1;
+// Streams every stored node of the tree as hex, one node per line under a
+// "level <n> <count>" line per row, from the leaves up. Output is formatted
+// into a fixed buffer and handed to write a buffer at a time.
+void export_merkle_hex(vote_merkle * merkle, void (*write)(const char * chunk, size_t len, void * ctx), void * ctx) {
+    char chunk[4096];
+    size_t used = 0;
+    for (unsigned int level = 0; level <= merkle->height; level++) {
+        size_t count = row_size(merkle->num_leafs, level);
+        if (sizeof(chunk) - used < 64) {
+            write(chunk, used, ctx);
+            used = 0;
+        }
+        used += snprintf(&chunk[used], sizeof(chunk) - used, "level %u %u\n", level, (unsigned int) count);
+        for (size_t i = 0; i < count; i++) {
+            if (sizeof(chunk) - used < NODE_SIZE * 2 + 2) {
+                write(chunk, used, ctx);
+                used = 0;
+            }
+            bytes_to_hex((char *) &merkle->levels[level][i], &chunk[used], NODE_SIZE);
+            used += NODE_SIZE * 2;
+            chunk[used++] = '\n';
+        }
+    }
+    if (used) write(chunk, used, ctx);
+}
 
-    int curr_depth = 0;
-    while (curr_depth < merkle->height) {
-        int xparent = parent(index);
-        int xneighbour = (is_right(index)) ? left_child(xparent): right_child(xparent);
-        memcpy(&merkle_proof[curr_depth], &merkle->nodes[xneighbour], NODE_SIZE);
-        index = xparent;
-        curr_depth++;
+// Writes the height siblings of a leaf into merkle_proof
+void fill_merkle_proof(vote_merkle * merkle, size_t leaf_index, node* merkle_proof) {
+    size_t index = leaf_index;
+
+    for (unsigned int level = 0; level < merkle->height; level++) {
+        // sibling is the other child of the same parent
+        memcpy(&merkle_proof[level], get_merkle_node(merkle, level, index ^ 1), NODE_SIZE);
+        index /= 2;
     }
+}
 
+node* create_merkle_proof(vote_merkle * merkle, size_t leaf_index) {
+    node *merkle_proof = malloc(NODE_SIZE * merkle->height);
+    if (merkle_proof != NULL) {
+        fill_merkle_proof(merkle, leaf_index, merkle_proof);
+    }
     return merkle_proof;
 }
 
-bool cmp(char* left, char* right, size_t n) {
+bool cmp(const char* left, const char* right, size_t n) {
     while (n--) {
         if (*left++ != *right++) {
             return false;
@@ -137,18 +719,326 @@ bool cmp(char* left, char* right, size_t n) {
     return true;
 }
 
+// Combines two siblings on `level`, skipping the hash when both are padding
+static void combine_siblings(node* left, node* right, node* parent, unsigned int level) {
+    node* empty = get_empty_node(level);
+    if (cmp((char *) left, (char *) empty, NODE_SIZE) && cmp((char *) right, (char *) empty, NODE_SIZE)) {
+        memcpy(parent, get_empty_node(level + 1), NODE_SIZE);
+    } else {
+        combine_nodes(left, right, parent);
+    }
+}
+
 bool verify_merkle_proof(node* merkle_root, node* merkle_proof, node* leaf_node, size_t leaf_index, size_t height) { 
-    size_t total_leafs = 1 << height;
-    int xindex = leaf_index + total_leafs - 1;
-    node* curr_aggr = leaf_node;
+    if (height >= MERKLE_EMPTY_LEVELS) return false;
+    size_t index = leaf_index;
+    node curr_aggr;
+    memcpy(&curr_aggr, leaf_node, NODE_SIZE);
     for (int i = 0; i < height; i++) {
-        if (is_right(xindex)) {
-            combine_nodes(&merkle_proof[i], curr_aggr, curr_aggr);
+        if (index & 1) {
+            combine_siblings(&merkle_proof[i], &curr_aggr, &curr_aggr, i);
         } else {
-            combine_nodes(curr_aggr, &merkle_proof[i], curr_aggr);
+            combine_siblings(&curr_aggr, &merkle_proof[i], &curr_aggr, i);
         }
-        xindex = parent(xindex);
+        index /= 2;
     }
     
-    return cmp((char *) curr_aggr, (char *) merkle_root, NODE_SIZE);
+    return cmp((char *) &curr_aggr, (char *) merkle_root, NODE_SIZE);
+}
+
+// Nodes already tied to the root by an earlier proof in the batch, in an
+// open addressing table keyed by position
+typedef struct {
+    bool used;
+    unsigned int level;
+    size_t index;
+    node value;
+} known_node;
+
+typedef struct {
+    known_node* slots;
+    size_t mask;
+} known_nodes;
+
+static known_node* find_known(known_nodes* known, unsigned int level, size_t index) {
+    size_t slot = (index * 2654435761u + level * 40503u) & known->mask;
+    while (known->slots[slot].used) {
+        if (known->slots[slot].level == level && known->slots[slot].index == index) {
+            return &known->slots[slot];
+        }
+        slot = (slot + 1) & known->mask;
+    }
+    return &known->slots[slot];
+}
+
+static void add_known(known_nodes* known, unsigned int level, size_t index, node* value) {
+    known_node* slot = find_known(known, level, index);
+    if (slot->used) return;
+    slot->used = true;
+    slot->level = level;
+    slot->index = index;
+    memcpy(&slot->value, value, NODE_SIZE);
+}
+
+// Checks one proof, stopping at the first node on its path that an earlier
+// proof confirmed. Once confirmed, the path and its siblings are remembered.
+static bool verify_known(known_nodes* known, merkle_proof_item* item, size_t height) {
+    node path[MERKLE_EMPTY_LEVELS];
+    node curr;
+    memcpy(&curr, item->leaf_node, NODE_SIZE);
+    size_t index = item->leaf_index;
+    unsigned int level = 0;
+    known_node* match;
+    // the root is known, so every in-range path ends at a known node
+    while (!(match = find_known(known, level, index))->used) {
+        if (level == height) return false;
+        memcpy(&path[level], &curr, NODE_SIZE);
+        if (index & 1) {
+            combine_siblings(&item->merkle_proof[level], &curr, &curr, level);
+        } else {
+            combine_siblings(&curr, &item->merkle_proof[level], &curr, level);
+        }
+        index /= 2;
+        level++;
+    }
+    if (!cmp((char *) &match->value, (char *) &curr, NODE_SIZE)) return false;
+
+    for (unsigned int i = 0; i < level; i++) {
+        size_t below = item->leaf_index >> i;
+        add_known(known, i, below, &path[i]);
+        add_known(known, i, below ^ 1, &item->merkle_proof[i]);
+    }
+    return true;
+}
+
+// Verifies many proofs against one root, setting valid[i] for each and
+// returning how many pass. Nodes confirmed by one proof end the paths of
+// later ones, so shared upper levels are hashed once; a leaf is accepted
+// once its path meets a confirmed node, whatever siblings the rest of its
+// proof holds. Inputs are not modified.
+size_t verify_merkle_proofs(node* merkle_root, merkle_proof_item* proofs, size_t num_proofs, size_t height, bool* valid) {
+    if (height >= MERKLE_EMPTY_LEVELS) {
+        memset(valid, 0, num_proofs * sizeof(bool));
+        return 0;
+    }
+
+    // each proof adds at most two nodes per level, keep the table half empty
+    size_t slots = 1;
+    while (slots < 4 * (2 * height * num_proofs + 1)) {
+        slots *= 2;
+    }
+    known_nodes known;
+    known.slots = malloc(slots * sizeof(known_node));
+    known.mask = slots - 1;
+
+    size_t num_valid = 0;
+    if (known.slots == NULL) {
+        // no memory to share work, check each proof on its own
+        for (size_t i = 0; i < num_proofs; i++) {
+            valid[i] = verify_merkle_proof(merkle_root, proofs[i].merkle_proof, proofs[i].leaf_node, proofs[i].leaf_index, height);
+            num_valid += valid[i];
+        }
+        return num_valid;
+    }
+
+    for (size_t i = 0; i < slots; i++) {
+        known.slots[i].used = false;
+    }
+    add_known(&known, height, 0, merkle_root);
+    for (size_t i = 0; i < num_proofs; i++) {
+        valid[i] = verify_known(&known, &proofs[i], height);
+        num_valid += valid[i];
+    }
+    free(known.slots);
+    return num_valid;
+}
+
+static bool strictly_increasing(size_t* indices, size_t n) {
+    for (size_t i = 1; i < n; i++) {
+        if (indices[i] <= indices[i - 1]) return false;
+    }
+    return true;
+}
+
+// Proves several leaves at once. Walking up a level at a time, a sibling is
+// only emitted when it isn't itself on one of the proven paths, so shared
+// upper nodes appear once. Siblings are stored level by level, left to
+// right, and their count is written to num_nodes.
+node* create_merkle_multiproof(vote_merkle * merkle, size_t* leaf_indices, size_t num_indices, size_t* num_nodes) {
+    *num_nodes = 0;
+    if (num_indices == 0 || !strictly_increasing(leaf_indices, num_indices)
+            || leaf_indices[num_indices - 1] >= merkle->num_leafs) {
+        return NULL;
+    }
+
+    size_t* indices = malloc(num_indices * sizeof(size_t));
+    node* proof = malloc(NODE_SIZE * (num_indices * merkle->height + 1));
+    if (indices == NULL || proof == NULL) {
+        free(indices);
+        free(proof);
+        return NULL;
+    }
+    memcpy(indices, leaf_indices, num_indices * sizeof(size_t));
+
+    size_t count = num_indices;
+    size_t emitted = 0;
+    for (unsigned int level = 0; level < merkle->height; level++) {
+        size_t parents = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (i + 1 < count && (indices[i] ^ 1) == indices[i + 1]) {
+                i++; // both children are on proven paths
+            } else {
+                memcpy(&proof[emitted++], get_merkle_node(merkle, level, indices[i] ^ 1), NODE_SIZE);
+            }
+            indices[parents++] = indices[i] / 2;
+        }
+        count = parents;
+    }
+    free(indices);
+
+    node* shrunk = realloc(proof, NODE_SIZE * (emitted ? emitted : 1));
+    *num_nodes = emitted;
+    return shrunk ? shrunk : proof;
+}
+
+// Checks a proof from create_merkle_multiproof. leaf_nodes[i] is the node of
+// leaf_indices[i] and the indices must be strictly increasing. Neither the
+// leaves nor the proof are modified.
+bool verify_merkle_multiproof(node* merkle_root, node* proof, size_t num_nodes, node* leaf_nodes, size_t* leaf_indices, size_t num_indices, size_t height) {
+    if (height >= MERKLE_EMPTY_LEVELS) return false;
+    if (num_indices == 0 || !strictly_increasing(leaf_indices, num_indices)
+            || (height < 8 * sizeof(size_t) && leaf_indices[num_indices - 1] >> height)) {
+        return false;
+    }
+
+    size_t* indices = malloc(num_indices * sizeof(size_t));
+    node* nodes = malloc(num_indices * NODE_SIZE);
+    if (indices == NULL || nodes == NULL) {
+        free(indices);
+        free(nodes);
+        return false;
+    }
+    memcpy(indices, leaf_indices, num_indices * sizeof(size_t));
+    memcpy(nodes, leaf_nodes, num_indices * NODE_SIZE);
+
+    size_t count = num_indices;
+    size_t used = 0;
+    bool valid = true;
+    for (unsigned int level = 0; level < height && valid; level++) {
+        size_t parents = 0;
+        for (size_t i = 0; i < count; i++) {
+            // parents are written at or behind i, so the row is reused in place
+            node* parent = &nodes[parents];
+            if (i + 1 < count && (indices[i] ^ 1) == indices[i + 1]) {
+                combine_siblings(&nodes[i], &nodes[i + 1], parent, level);
+                indices[parents++] = indices[i++] / 2;
+            } else if (used == num_nodes) {
+                valid = false;
+                break;
+            } else if (indices[i] & 1) {
+                combine_siblings(&proof[used++], &nodes[i], parent, level);
+                indices[parents++] = indices[i] / 2;
+            } else {
+                combine_siblings(&nodes[i], &proof[used++], parent, level);
+                indices[parents++] = indices[i] / 2;
+            }
+        }
+        count = parents;
+    }
+
+    valid = valid && used == num_nodes && count == 1
+        && cmp((char *) &nodes[0], (char *) merkle_root, NODE_SIZE);
+    free(indices);
+    free(nodes);
+    return valid;
+}
+
+// Writes the proof of one leaf into buf in the wire format and returns its
+// length, or 0 if buf is too small or the leaf isn't in the tree. Called
+// with a NULL buf it only returns the length.
+size_t encode_merkle_proof(vote_merkle * merkle, size_t leaf_index, char* buf, size_t buf_size) {
+    if (leaf_index >= merkle->num_leafs) return 0;
+
+    merkle_proof_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PROOF_MAGIC, sizeof(header.magic));
+    header.version = PROOF_VERSION;
+    header.candidates = MERKLE_CANDIDATES;
+    header.height = merkle->height;
+    header.leaf_index = leaf_index;
+
+    size_t size = sizeof(header);
+    for (unsigned int level = 0; level < merkle->height; level++) {
+        if (((leaf_index >> level) ^ 1) >= row_size(merkle->num_leafs, level)) {
+            header.empty_siblings |= (uint64_t) 1 << level;
+        } else {
+            size += NODE_SIZE;
+        }
+    }
+    if (buf == NULL) return size;
+    if (buf_size < size) return 0;
+
+    memcpy(buf, &header, sizeof(header));
+    char* sibling = buf + sizeof(header);
+    for (unsigned int level = 0; level < merkle->height; level++) {
+        if (!(header.empty_siblings >> level & 1)) {
+            memcpy(sibling, &merkle->levels[level][(leaf_index >> level) ^ 1], NODE_SIZE);
+            sibling += NODE_SIZE;
+        }
+    }
+    return size;
+}
+
+// Checks the header at the start of buf and returns the length of the
+// proof it begins, or 0 if it isn't a complete proof for this build
+size_t encoded_proof_size(const char* buf, size_t len) {
+    merkle_proof_header header;
+    if (len < sizeof(header)) return 0;
+    memcpy(&header, buf, sizeof(header));
+    if (!cmp(header.magic, PROOF_MAGIC, sizeof(header.magic)) || header.version != PROOF_VERSION
+            || header.candidates != MERKLE_CANDIDATES || header.height >= MERKLE_EMPTY_LEVELS
+            || header.leaf_index >> header.height) {
+        return 0;
+    }
+
+    size_t size = sizeof(header);
+    for (unsigned int level = 0; level < header.height; level++) {
+        if (!(header.empty_siblings >> level & 1)) size += NODE_SIZE;
+    }
+    return len < size ? 0 : size;
+}
+
+// Verifies an encoded proof where it lies. Siblings are hashed straight out
+// of buf when it is 4-byte aligned, nothing is allocated.
+bool verify_encoded_proof(node* merkle_root, node* leaf_node, const char* buf, size_t len) {
+    if (encoded_proof_size(buf, len) == 0) return false;
+    merkle_proof_header header;
+    memcpy(&header, buf, sizeof(header));
+
+    const char* sibling = buf + sizeof(header);
+    bool aligned = ((size_t) sibling & 3) == 0;
+    uint64_t index = header.leaf_index;
+    node curr_aggr, unaligned;
+    memcpy(&curr_aggr, leaf_node, NODE_SIZE);
+    for (unsigned int level = 0; level < header.height; level++) {
+        node* other;
+        if (header.empty_siblings >> level & 1) {
+            other = get_empty_node(level);
+        } else if (aligned) {
+            other = (node *) sibling;
+            sibling += NODE_SIZE;
+        } else {
+            memcpy(&unaligned, sibling, NODE_SIZE);
+            other = &unaligned;
+            sibling += NODE_SIZE;
+        }
+        if (index & 1) {
+            combine_siblings(other, &curr_aggr, &curr_aggr, level);
+        } else {
+            combine_siblings(&curr_aggr, other, &curr_aggr, level);
+        }
+        index /= 2;
+    }
+
+    return cmp((char *) &curr_aggr, (char *) merkle_root, NODE_SIZE);
 }
@@ -1,29 +1,85 @@
+#ifndef MERKLE_H
+#define MERKLE_H
+
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+
+// Candidates on the ballot, override with -DMERKLE_CANDIDATES=n
+#ifndef MERKLE_CANDIDATES
+#define MERKLE_CANDIDATES 2
+#endif
 
 #define PTR_SIZE 8
-#define NODE_SIZE 33
+#define NODE_SIZE (32 + 4 * MERKLE_CANDIDATES)
 #define UNSIGNED_LEAF_SIZE 65
 #define LEAF_SIZE 97 
-#define MERKLE_SIZE 1 + PTR_SIZE
+#define MERKLE_MAX_HEIGHT 31
+#define MERKLE_EMPTY_LEVELS 64 // Padding is known for 64-bit leaf indices
 
+// The counts are hashed along with the hash when nodes are combined, so the
+// tally is covered by the root
 typedef struct {
     char hash[32];
-    char vote_count;
+    uint32_t vote_count[MERKLE_CANDIDATES]; // Votes per candidate below this node
 } node;
 
 typedef struct { 
     char hash[32]; // Public Key of voter
     char randomness[32]; // Randomness 
-    char vote; // 0 or 1 
+    char vote; // Candidate index, below MERKLE_CANDIDATES
     char sig[32]; // Signature
 } leaf;
 
+// levels[0] is the leaf row and levels[height] holds the root. Rows only
+// store nodes with at least one real leaf below them, see get_merkle_node.
+// Levels above height are NULL, except a root row reserve_merkle_leaf has
+// allocated for the next append.
 typedef struct {
     unsigned char height;
-    node * nodes;
+    size_t num_leafs; // Leaves appended so far
+    size_t capacity; // Leaf slots allocated
+    node * levels[MERKLE_MAX_HEIGHT + 1];
+#ifdef MERKLE_MMAP
+    void * image; // File mapping the rows point into, NULL once they're malloc'd
+    size_t image_size;
+#endif
 } vote_merkle;
 
+// Builds only the root, for leaves arriving one at a time. pending holds one
+// finished subtree per level, so memory stays O(log n).
+typedef struct {
+    size_t num_leafs;
+    node pending[MERKLE_MAX_HEIGHT + 1];
+} merkle_stream;
+
+// One proof for verify_merkle_proofs
+typedef struct {
+    node * leaf_node;
+    size_t leaf_index;
+    node * merkle_proof;
+} merkle_proof_item;
+
+// Wire format of a single proof: this header, then the stored siblings from
+// the leaf level up, NODE_SIZE bytes each in node layout. Siblings that are
+// empty subtrees are flagged in empty_siblings and left out. Integers are
+// little-endian, as on the Pi and x86 hosts, and every encoded proof is a
+// multiple of 4 bytes long, so proofs can be packed back to back.
+#define PROOF_MAGIC "MP"
+#define PROOF_VERSION 1
+
+typedef struct {
+    char magic[2];
+    uint8_t version;
+    uint8_t candidates; // MERKLE_CANDIDATES of the tree
+    uint8_t height;
+    uint8_t reserved[3];
+    uint64_t leaf_index;
+    uint64_t empty_siblings; // Bit i set if the level i sibling is empty
+} merkle_proof_header;
+
+#define merkle_root(merkle) get_merkle_node(merkle, (merkle)->height, 0)
+
 void SHA256(const char * data, size_t len, char * hash);
 
 void print_bytes(void * bytes, int len);
@@ -31,7 +87,9 @@ void leaf_to_node(leaf * leafsrc, node * newnode);
 
 void bytes_to_hex(char * bytes, char * buf, int n);
 
-void hex_to_bytes(const char * hex, char * buf, size_t n);
+bool hex_to_bytes(const char * hex, char * buf, size_t n);
+
+void export_merkle_hex(vote_merkle * merkle, void (*write)(const char * chunk, size_t len, void * ctx), void * ctx);
 
 void concat_nodes(node *left, node *right, char* buf, int buf_size);
 
@@ -39,10 +97,65 @@ void hash_nodes(node *left, node *right, char* hash);
 
 void combine_nodes(node *left, node *right, node* parent);
 
-vote_merkle* create_merkle_tree(leaf* leafs, int num_leafs);
+void set_leaf_votes(leaf * leafsrc, node * newnode);
+
+void add_vote_counts(node *left, node *right, node* parent);
+
+node* get_empty_node(unsigned int level);
+
+node* get_merkle_node(vote_merkle * merkle, unsigned int level, size_t index);
+
+vote_merkle* create_merkle_tree(leaf* leafs, size_t num_leafs);
+
+// Allocates a tree for num_leafs leaves without hashing anything, for rows
+// restored from storage. Row level holds merkle_row_size(merkle, level) nodes.
+vote_merkle* alloc_merkle_tree(size_t num_leafs);
+
+size_t merkle_row_size(vote_merkle * merkle, unsigned int level);
+
+void merkle_stream_init(merkle_stream* stream);
+
+bool merkle_stream_add(merkle_stream* stream, leaf* new_leaf);
+
+bool merkle_stream_add_leafs(merkle_stream* stream, leaf* leafs, size_t num_leafs);
+
+void merkle_stream_root(merkle_stream* stream, node* root);
+
+#ifdef MERKLE_THREADS
+vote_merkle* create_merkle_tree_parallel(leaf* leafs, size_t num_leafs, unsigned int num_threads);
+#endif
+
+// Allocates whatever the next append_merkle_leaf needs, so that append
+// can't fail. Returns false if out of memory or the tree is full.
+bool reserve_merkle_leaf(vote_merkle * merkle);
+
+node* append_merkle_leaf(vote_merkle * merkle, leaf * new_leaf);
+
+void free_merkle_tree(vote_merkle * merkle);
+
+#ifdef MERKLE_MMAP
+bool save_merkle_tree(vote_merkle * merkle, leaf* leafs, const char* path);
+vote_merkle* load_merkle_tree(const char* path, leaf** leafs);
+#endif
+
+void fill_merkle_proof(vote_merkle * merkle, size_t leaf_index, node* merkle_proof);
 
 node* create_merkle_proof(vote_merkle * merkle, size_t leaf_index);
 
-bool cmp(char * left, char * right, size_t n);
+bool cmp(const char * left, const char * right, size_t n);
+
+bool verify_merkle_proof(node* merkle_root, node* merkle_proof, node* leaf_node, size_t leaf_index, size_t height);
+
+size_t verify_merkle_proofs(node* merkle_root, merkle_proof_item* proofs, size_t num_proofs, size_t height, bool* valid);
+
+size_t encode_merkle_proof(vote_merkle * merkle, size_t leaf_index, char* buf, size_t buf_size);
+
+size_t encoded_proof_size(const char* buf, size_t len);
+
+bool verify_encoded_proof(node* merkle_root, node* leaf_node, const char* buf, size_t len);
+
+node* create_merkle_multiproof(vote_merkle * merkle, size_t* leaf_indices, size_t num_indices, size_t* num_nodes);
+
+bool verify_merkle_multiproof(node* merkle_root, node* proof, size_t num_nodes, node* leaf_nodes, size_t* leaf_indices, size_t num_indices, size_t height);
 
-bool verify_merkle_proof(node* merkle_root, node* merkle_proof, node* leaf_node, size_t leaf_index, size_t height);
\ No newline at end of file
+#endif
@@ -0,0 +1,198 @@
+#define _POSIX_C_SOURCE 200809L // fseeko
+#define _FILE_OFFSET_BITS 64
+
+#include "merkle_disk.h"
+#include "sha256.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * The tree is built a row at a time: the leaf file, then each finished row,
+ * is read front to back in DISK_BATCH sized chunks and the row above is
+ * appended to its segment a chunk at a time. RAM use is a few fixed
+ * buffers regardless of the number of leaves.
+ */
+
+// Parents produced per chunk
+#define DISK_BATCH 4096
+// Messages handed to sha256_many per call
+#define HASH_LANES 64
+
+#define disk_row_size(n, level) ((n) ? (((n) - 1) >> (level)) + 1 : 0)
+
+static void segment_path(char* buf, size_t buf_size, const char* prefix, unsigned int level) {
+    snprintf(buf, buf_size, "%s.level%u", prefix, level);
+}
+
+static FILE* open_segment(const char* prefix, unsigned int level, const char* mode) {
+    char path[strlen(prefix) + sizeof(".level") + 3];
+    segment_path(path, sizeof(path), prefix, level);
+    return fopen(path, mode);
+}
+
+static unsigned int disk_tree_height(uint64_t num_leafs) {
+    unsigned int height = 0;
+    while (height < 64 && ((uint64_t) 1 << height) < num_leafs) {
+        height++;
+    }
+    return height;
+}
+
+// Hashes n messages of len bytes each into out, HASH_LANES at a time
+static void hash_run(const BYTE* msgs, size_t len, node* out, size_t n) {
+    const BYTE* in[HASH_LANES];
+    BYTE* hashes[HASH_LANES];
+    for (size_t start = 0; start < n; start += HASH_LANES) {
+        size_t batch = (n - start < HASH_LANES) ? n - start : HASH_LANES;
+        for (size_t i = 0; i < batch; i++) {
+            in[i] = msgs + (start + i) * len;
+            hashes[i] = (BYTE*) out[start + i].hash;
+        }
+        sha256_many(in, len, hashes, batch);
+    }
+}
+
+// Writes the leaf row from the raw leaf records in leafs
+static bool write_leaf_row(FILE* leafs, FILE* row, uint64_t num_leafs) {
+    leaf* in = malloc(DISK_BATCH * sizeof(leaf));
+    node* out = malloc(DISK_BATCH * NODE_SIZE);
+    bool ok = in != NULL && out != NULL;
+    for (uint64_t done = 0; done < num_leafs && ok; ) {
+        size_t batch = (num_leafs - done < DISK_BATCH) ? num_leafs - done : DISK_BATCH;
+        ok = fread(in, LEAF_SIZE, batch, leafs) == batch;
+        if (!ok) break;
+        hash_run((const BYTE*) in, LEAF_SIZE, out, batch);
+        for (size_t i = 0; i < batch; i++) {
+            set_leaf_votes(&in[i], &out[i]);
+        }
+        ok = fwrite(out, NODE_SIZE, batch, row) == batch;
+        done += batch;
+    }
+    free(in);
+    free(out);
+    return ok;
+}
+
+// Writes row `level` from the row below it. Chunks hold an even number of
+// nodes, so only the very last one can end on a node without a sibling.
+static bool write_parent_row(FILE* below, FILE* row, uint64_t below_size, unsigned int level) {
+    node* in = malloc(2 * DISK_BATCH * NODE_SIZE);
+    node* out = malloc(DISK_BATCH * NODE_SIZE);
+    bool ok = in != NULL && out != NULL;
+    for (uint64_t done = 0; done < below_size && ok; ) {
+        size_t batch = (below_size - done < 2 * DISK_BATCH) ? below_size - done : 2 * DISK_BATCH;
+        ok = fread(in, NODE_SIZE, batch, below) == batch;
+        if (!ok) break;
+        size_t pairs = batch / 2;
+        hash_run((const BYTE*) in, NODE_SIZE * 2, out, pairs);
+        for (size_t i = 0; i < pairs; i++) {
+            add_vote_counts(&in[2 * i], &in[2 * i + 1], &out[i]);
+        }
+        // a trailing odd node pairs with an empty subtree
+        if (batch % 2) {
+            combine_nodes(&in[batch - 1], get_empty_node(level - 1), &out[pairs++]);
+        }
+        ok = fwrite(out, NODE_SIZE, pairs, row) == pairs;
+        done += batch;
+    }
+    free(in);
+    free(out);
+    return ok;
+}
+
+// Builds a tree over a file of raw leaf records into segments named after
+// prefix, replacing any already there. Returns the tree opened for reading.
+disk_merkle* build_disk_merkle_tree(const char* leaf_path, const char* prefix) {
+    FILE* leafs = fopen(leaf_path, "rb");
+    if (leafs == NULL) return NULL;
+    bool ok = fseeko(leafs, 0, SEEK_END) == 0;
+    off_t size = ftello(leafs);
+    ok = ok && size >= 0 && size % LEAF_SIZE == 0 && fseeko(leafs, 0, SEEK_SET) == 0;
+    uint64_t num_leafs = ok ? (uint64_t) size / LEAF_SIZE : 0;
+    unsigned int height = disk_tree_height(num_leafs);
+    ok = ok && height <= MERKLE_DISK_MAX_HEIGHT;
+
+    FILE* row = ok ? open_segment(prefix, 0, "w+b") : NULL;
+    ok = row != NULL && write_leaf_row(leafs, row, num_leafs);
+    fclose(leafs);
+
+    for (unsigned int level = 1; level <= height && ok; level++) {
+        FILE* below = row;
+        row = open_segment(prefix, level, "w+b");
+        ok = row != NULL && fseeko(below, 0, SEEK_SET) == 0
+            && write_parent_row(below, row, disk_row_size(num_leafs, level - 1), level);
+        fclose(below);
+    }
+    ok = row != NULL && fclose(row) == 0 && ok;
+
+    return ok ? open_disk_merkle_tree(prefix) : NULL;
+}
+
+// Opens segments written by build_disk_merkle_tree, checking each row has
+// the length the leaf count implies
+disk_merkle* open_disk_merkle_tree(const char* prefix) {
+    disk_merkle* merkle = malloc(sizeof(disk_merkle));
+    if (merkle == NULL) return NULL;
+    merkle->height = 0;
+    merkle->levels[0] = open_segment(prefix, 0, "rb");
+    bool ok = merkle->levels[0] != NULL && fseeko(merkle->levels[0], 0, SEEK_END) == 0;
+    off_t size = ok ? ftello(merkle->levels[0]) : -1;
+    ok = ok && size >= 0 && size % NODE_SIZE == 0;
+    merkle->num_leafs = ok ? (uint64_t) size / NODE_SIZE : 0;
+    unsigned int height = disk_tree_height(merkle->num_leafs);
+    ok = ok && height <= MERKLE_DISK_MAX_HEIGHT;
+
+    for (unsigned int level = 1; level <= height && ok; level++) {
+        merkle->levels[level] = open_segment(prefix, level, "rb");
+        if (merkle->levels[level] == NULL) break;
+        merkle->height = level;
+        ok = fseeko(merkle->levels[level], 0, SEEK_END) == 0
+            && ftello(merkle->levels[level]) == (off_t) (NODE_SIZE * disk_row_size(merkle->num_leafs, level));
+    }
+    ok = ok && merkle->height == height;
+
+    if (!ok) {
+        if (merkle->levels[0] != NULL) close_disk_merkle_tree(merkle);
+        else free(merkle);
+        return NULL;
+    }
+    return merkle;
+}
+
+void close_disk_merkle_tree(disk_merkle* merkle) {
+    for (unsigned int level = 0; level <= merkle->height; level++) {
+        fclose(merkle->levels[level]);
+    }
+    free(merkle);
+}
+
+// Reads one node, or the empty subtree past the last stored node of its row
+bool get_disk_merkle_node(disk_merkle* merkle, unsigned int level, uint64_t index, node* out) {
+    if (index >= disk_row_size(merkle->num_leafs, level)) {
+        memcpy(out, get_empty_node(level), NODE_SIZE);
+        return true;
+    }
+    FILE* row = merkle->levels[level];
+    return fseeko(row, (off_t) (index * NODE_SIZE), SEEK_SET) == 0 && fread(out, NODE_SIZE, 1, row) == 1;
+}
+
+bool disk_merkle_root(disk_merkle* merkle, node* root) {
+    return get_disk_merkle_node(merkle, merkle->height, 0, root);
+}
+
+// Same layout as create_merkle_proof, reading one node per level. NULL for
+// a leaf past the end.
+node* create_disk_merkle_proof(disk_merkle* merkle, uint64_t leaf_index) {
+    if (leaf_index >= merkle->num_leafs) return NULL;
+    node* merkle_proof = malloc(NODE_SIZE * (merkle->height ? merkle->height : 1));
+    if (merkle_proof == NULL) return NULL;
+    uint64_t index = leaf_index;
+    for (unsigned int level = 0; level < merkle->height; level++) {
+        if (!get_disk_merkle_node(merkle, level, index ^ 1, &merkle_proof[level])) {
+            free(merkle_proof);
+            return NULL;
+        }
+        index /= 2;
+    }
+    return merkle_proof;
+}
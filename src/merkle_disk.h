@@ -0,0 +1,35 @@
+#ifndef MERKLE_DISK_H
+#define MERKLE_DISK_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "merkle.h"
+
+/*
+ * Out-of-core Merkle tree for leaf sets larger than RAM. Each row lives in
+ * its own segment file, "<prefix>.level<n>", holding the row's stored nodes
+ * in order, with padding implied exactly as in vote_merkle. Linux only, not
+ * part of the Pi build.
+ */
+
+#define MERKLE_DISK_MAX_HEIGHT (MERKLE_EMPTY_LEVELS - 1)
+
+typedef struct {
+    uint64_t num_leafs;
+    unsigned int height;
+    FILE * levels[MERKLE_DISK_MAX_HEIGHT + 1]; // Open segment of each row
+} disk_merkle;
+
+disk_merkle* build_disk_merkle_tree(const char* leaf_path, const char* prefix);
+
+disk_merkle* open_disk_merkle_tree(const char* prefix);
+
+void close_disk_merkle_tree(disk_merkle* merkle);
+
+bool get_disk_merkle_node(disk_merkle* merkle, unsigned int level, uint64_t index, node* out);
+
+bool disk_merkle_root(disk_merkle* merkle, node* root);
+
+node* create_disk_merkle_proof(disk_merkle* merkle, uint64_t leaf_index);
+
+#endif
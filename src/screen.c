@@ -154,6 +154,15 @@ void merkle_rect(int x, int y, color_t color, unsigned int num, bool show_num) {
 #define parent(i) (i - 1) / 2
 #define is_right(i) i % 2 == 0
 
+// Votes for any candidate below a node
+static unsigned int total_votes(node* tally) {
+    unsigned int total = 0;
+    for (int i = 0; i < MERKLE_CANDIDATES; i++) {
+        total += tally->vote_count[i];
+    }
+    return total;
+}
+
 void draw_fraud_visual_screen(node* merkle_proof, vote_merkle* merkle, int node_index, bool empty_proof) {
     if (node_index == -1) {
         gl_draw_rect(em(5), em(5), em(110), em(90), GL_WHITE);
@@ -188,13 +197,13 @@ void draw_fraud_visual_screen(node* merkle_proof, vote_merkle* merkle, int node_
         unsigned int num_leafs = 1 << tree_height;
 
         printf("Merkle Leaf:\n");
-        print_bytes(&merkle->nodes[num_leafs - 1 + node_index], 32);
+        print_bytes(get_merkle_node(merkle, 0, node_index), 32);
         printf("Merkle Proof:\n");
         for (int i = 0; i < merkle->height; i++) {
             print_bytes(&merkle_proof[i], 32);
         }
         printf("Merkle Root:\n");
-        print_bytes(&merkle->nodes[0], 32);
+        print_bytes(merkle_root(merkle), 32);
  
         // Colour Nodes 
         size_t cols[num_leafs * 2 - 1];
@@ -223,7 +232,7 @@ void draw_fraud_visual_screen(node* merkle_proof, vote_merkle* merkle, int node_
                 if (color == 0) {
                     merkle_rect(currx, curr_y, color, 0, false);
                 } else {
-                    merkle_rect(currx, curr_y, color, (unsigned int) merkle->nodes[true_index].vote_count, true);
+                    merkle_rect(currx, curr_y, color, total_votes(get_merkle_node(merkle, tree_height - i, j)), true);
                 }
                 currx += row_sep;
                 true_index++;
@@ -239,9 +248,8 @@ void draw_fraud_visual_screen(node* merkle_proof, vote_merkle* merkle, int node_
 
 void draw_results_screen(unsigned int num_votes, vote_merkle* merkle_tree) {
     printf("%d\n", num_votes);
-    unsigned int vote_count = merkle_tree->nodes[0].vote_count;
-    unsigned int christos_vote = vote_count;
-    unsigned int matt_vote = num_votes - vote_count;
+    unsigned int matt_vote = merkle_root(merkle_tree)->vote_count[0];
+    unsigned int christos_vote = merkle_root(merkle_tree)->vote_count[1];
 
     gl_draw_rect(em(5), em(5), em(110), em(90), GL_WHITE);
 
@@ -259,7 +267,7 @@ void draw_results_screen(unsigned int num_votes, vote_merkle* merkle_tree) {
     gl_draw_string(em(10), em(45), christos_vote_str, GL_BLACK);
 
     char root_hash[21];
-    bytes_to_hex(merkle_tree->nodes[0].hash, root_hash, 10);
+    bytes_to_hex(merkle_root(merkle_tree)->hash, root_hash, 10);
     root_hash[20] = '\0';
 
     gl_draw_string(em(10), em(60), "Merkle Root", GL_BLACK);
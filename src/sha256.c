@@ -17,6 +17,23 @@
 #include "malloc.h"
 #include "sha256.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#include <cpuid.h>
+#define SHA256_HAVE_SHANI
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define SHA256_HAVE_ARMV8
+#if defined(__linux__)
+#include <sys/auxv.h>
+#ifndef HWCAP_SHA2
+#define HWCAP_SHA2 (1 << 6)
+#endif
+#endif
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 /****************************** MACROS ******************************/
 #define ROTLEFT(a,b) (((a) << (b)) | ((a) >> (32-(b))))
 #define ROTRIGHT(a,b) (((a) >> (b)) | ((a) << (32-(b))))
@@ -41,49 +58,277 @@ static const WORD k[64] = {
 };
 
 /*********************** FUNCTION DEFINITIONS ***********************/
-void sha256_transform(SHA256_CTX *ctx, const BYTE data[])
+// Loads a big endian word at word width; __builtin_memcpy stays inline even
+// in freestanding builds and tolerates unaligned input.
+static inline WORD load_be32(const BYTE *p)
 {
-	WORD a, b, c, d, e, f, g, h, i, j, t1, t2, m[64];
+	WORD w;
 
-	for (i = 0, j = 0; i < 16; ++i, j += 4)
-		m[i] = (data[j] << 24) | (data[j + 1] << 16) | (data[j + 2] << 8) | (data[j + 3]);
-	for ( ; i < 64; ++i)
-		m[i] = SIG1(m[i - 2]) + m[i - 7] + SIG0(m[i - 15]) + m[i - 16];
+	__builtin_memcpy(&w, p, 4);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	w = __builtin_bswap32(w);
+#endif
+	return w;
+}
 
-	a = ctx->state[0];
-	b = ctx->state[1];
-	c = ctx->state[2];
-	d = ctx->state[3];
-	e = ctx->state[4];
-	f = ctx->state[5];
-	g = ctx->state[6];
-	h = ctx->state[7];
+// Expands w[i] into the 16 word ring, overwriting w[i - 16]
+#define SCHEDULE(i) (m[(i) & 15] += SIG1(m[((i) - 2) & 15]) + m[((i) - 7) & 15] + SIG0(m[((i) - 15) & 15]))
 
-	for (i = 0; i < 64; ++i) {
-		t1 = h + EP1(e) + CH(e,f,g) + k[i] + m[i];
-		t2 = EP0(a) + MAJ(a,b,c);
-		h = g;
-		g = f;
-		f = e;
-		e = d + t1;
-		d = c;
-		c = b;
-		b = a;
-		a = t1 + t2;
+// One round with the working variables renamed instead of shifted: the new
+// e lands in d and the new a in h. `i` is a constant, so the schedule test
+// folds away.
+#define ROUND(a,b,c,d,e,f,g,h,i) do { \
+	if ((i) >= 16) \
+		SCHEDULE(i); \
+	t1 = h + EP1(e) + CH(e,f,g) + k[i] + m[(i) & 15]; \
+	d += t1; \
+	h = t1 + EP0(a) + MAJ(a,b,c); \
+} while (0)
+
+#define ROUND8(i) \
+	ROUND(a,b,c,d,e,f,g,h,(i)); \
+	ROUND(h,a,b,c,d,e,f,g,(i) + 1); \
+	ROUND(g,h,a,b,c,d,e,f,(i) + 2); \
+	ROUND(f,g,h,a,b,c,d,e,(i) + 3); \
+	ROUND(e,f,g,h,a,b,c,d,(i) + 4); \
+	ROUND(d,e,f,g,h,a,b,c,(i) + 5); \
+	ROUND(c,d,e,f,g,h,a,b,(i) + 6); \
+	ROUND(b,c,d,e,f,g,h,a,(i) + 7)
+
+static void sha256_transform_c(WORD state[8], const BYTE data[], size_t blocks)
+{
+	WORD a, b, c, d, e, f, g, h, i, t1, m[16];
+
+	for ( ; blocks > 0; --blocks, data += 64) {
+		for (i = 0; i < 16; ++i)
+			m[i] = load_be32(data + i * 4);
+
+		a = state[0];
+		b = state[1];
+		c = state[2];
+		d = state[3];
+		e = state[4];
+		f = state[5];
+		g = state[6];
+		h = state[7];
+
+		ROUND8(0);
+		ROUND8(8);
+		ROUND8(16);
+		ROUND8(24);
+		ROUND8(32);
+		ROUND8(40);
+		ROUND8(48);
+		ROUND8(56);
+
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+		state[5] += f;
+		state[6] += g;
+		state[7] += h;
 	}
+}
+
+#ifdef SHA256_HAVE_SHANI
+// x86 SHA extensions. The state is kept as ABEF/CDGH register pairs, which
+// is the layout _mm_sha256rnds2_epu32 works on.
+__attribute__((target("sha,sse4.1")))
+static void sha256_transform_shani(WORD state[8], const BYTE data[], size_t blocks)
+{
+	const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	__m128i state0, state1, abef, cdgh, tmp, wk, m[4];
+	int i;
+
+	tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xB1);	// CDAB
+	state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1B);	// EFGH
+	state0 = _mm_alignr_epi8(tmp, state1, 8);	// ABEF
+	state1 = _mm_blend_epi16(state1, tmp, 0xF0);	// CDGH
 
-	ctx->state[0] += a;
-	ctx->state[1] += b;
-	ctx->state[2] += c;
-	ctx->state[3] += d;
-	ctx->state[4] += e;
-	ctx->state[5] += f;
-	ctx->state[6] += g;
-	ctx->state[7] += h;
+	for ( ; blocks > 0; --blocks, data += 64) {
+		abef = state0;
+		cdgh = state1;
+		for (i = 0; i < 4; ++i)
+			m[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + i * 16)), bswap);
+
+		// Four rounds per step; m[i & 3] holds w[4i..4i+3] and is then
+		// replaced by w[4i+16..4i+19].
+		for (i = 0; i < 16; ++i) {
+			wk = _mm_add_epi32(m[i & 3], _mm_loadu_si128((const __m128i *)&k[i * 4]));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, wk);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(wk, 0x0E));
+			if (i < 12) {
+				tmp = _mm_add_epi32(_mm_sha256msg1_epu32(m[i & 3], m[(i + 1) & 3]),
+				                    _mm_alignr_epi8(m[(i + 3) & 3], m[(i + 2) & 3], 4));
+				m[i & 3] = _mm_sha256msg2_epu32(tmp, m[(i + 3) & 3]);
+			}
+		}
+
+		state0 = _mm_add_epi32(state0, abef);
+		state1 = _mm_add_epi32(state1, cdgh);
+	}
+
+	tmp = _mm_shuffle_epi32(state0, 0x1B);	// FEBA
+	state1 = _mm_shuffle_epi32(state1, 0xB1);	// DCHG
+	_mm_storeu_si128((__m128i *)&state[0], _mm_blend_epi16(tmp, state1, 0xF0));	// DCBA
+	_mm_storeu_si128((__m128i *)&state[4], _mm_alignr_epi8(state1, tmp, 8));	// HGFE
+}
+
+static int sha256_shani_supported(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_SSE4_1) || !(ecx & bit_SSSE3))
+		return 0;
+	if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+		return 0;
+	return (ebx & bit_SHA) != 0;
+}
+#endif
+
+#ifdef SHA256_HAVE_ARMV8
+// ARMv8 cryptography extensions, state kept as ABCD/EFGH.
+__attribute__((target("+crypto")))
+static void sha256_transform_armv8(WORD state[8], const BYTE data[], size_t blocks)
+{
+	uint32x4_t state0, state1, abcd, efgh, prev, wk, m[4];
+	int i;
+
+	state0 = vld1q_u32(&state[0]);
+	state1 = vld1q_u32(&state[4]);
+
+	for ( ; blocks > 0; --blocks, data += 64) {
+		abcd = state0;
+		efgh = state1;
+		for (i = 0; i < 4; ++i)
+			m[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + i * 16)));
+
+		// Same four round step and schedule rotation as the SHA-NI path
+		for (i = 0; i < 16; ++i) {
+			wk = vaddq_u32(m[i & 3], vld1q_u32(&k[i * 4]));
+			prev = state0;
+			state0 = vsha256hq_u32(state0, state1, wk);
+			state1 = vsha256h2q_u32(state1, prev, wk);
+			if (i < 12)
+				m[i & 3] = vsha256su1q_u32(vsha256su0q_u32(m[i & 3], m[(i + 1) & 3]),
+				                           m[(i + 2) & 3], m[(i + 3) & 3]);
+		}
+
+		state0 = vaddq_u32(state0, abcd);
+		state1 = vaddq_u32(state1, efgh);
+	}
+
+	vst1q_u32(&state[0], state0);
+	vst1q_u32(&state[4], state1);
+}
+
+static int sha256_armv8_supported(void)
+{
+#if defined(__linux__)
+	return (getauxval(AT_HWCAP) & HWCAP_SHA2) != 0;
+#else
+	// Bare metal runs at EL1 and can read the ISA feature register directly
+	unsigned long long isar0;
+	__asm__("mrs %0, id_aa64isar0_el1" : "=r"(isar0));
+	return ((isar0 >> 12) & 0xf) != 0;
+#endif
+}
+#endif
+
+static int sha256_always_supported(void)
+{
+	return 1;
+}
+
+// Preferred backends first; the portable C transform always comes last.
+static const SHA256_BACKEND backends[] = {
+#ifdef SHA256_HAVE_SHANI
+	{ "sha-ni", sha256_shani_supported, sha256_transform_shani },
+#endif
+#ifdef SHA256_HAVE_ARMV8
+	{ "armv8-crypto", sha256_armv8_supported, sha256_transform_armv8 },
+#endif
+	{ "c", sha256_always_supported, sha256_transform_c },
+};
+
+static const SHA256_BACKEND *active_backend = NULL;
+
+// Known answers from FIPS 180-2 appendix B, covering one and two block messages
+static int sha256_self_test(void)
+{
+	static const char *msgs[] = {
+		"abc",
+		"",
+		"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+	};
+	static const BYTE digests[][SHA256_BLOCK_SIZE] = {
+		{ 0xba,0x78,0x16,0xbf,0x8f,0x01,0xcf,0xea,0x41,0x41,0x40,0xde,0x5d,0xae,0x22,0x23,
+		  0xb0,0x03,0x61,0xa3,0x96,0x17,0x7a,0x9c,0xb4,0x10,0xff,0x61,0xf2,0x00,0x15,0xad },
+		{ 0xe3,0xb0,0xc4,0x42,0x98,0xfc,0x1c,0x14,0x9a,0xfb,0xf4,0xc8,0x99,0x6f,0xb9,0x24,
+		  0x27,0xae,0x41,0xe4,0x64,0x9b,0x93,0x4c,0xa4,0x95,0x99,0x1b,0x78,0x52,0xb8,0x55 },
+		{ 0x24,0x8d,0x6a,0x61,0xd2,0x06,0x38,0xb8,0xe5,0xc0,0x26,0x93,0x0c,0x3e,0x60,0x39,
+		  0xa3,0x3c,0xe4,0x59,0x64,0xff,0x21,0x67,0xf6,0xec,0xed,0xd4,0x19,0xdb,0x06,0xc1 },
+	};
+	SHA256_CTX ctx;
+	BYTE hash[SHA256_BLOCK_SIZE];
+	size_t i, j;
+
+	for (i = 0; i < sizeof(msgs) / sizeof(msgs[0]); ++i) {
+		sha256_init(&ctx);
+		sha256_update(&ctx, (const BYTE *)msgs[i], strlen(msgs[i]));
+		sha256_final(&ctx, hash);
+		for (j = 0; j < SHA256_BLOCK_SIZE; ++j) {
+			if (hash[j] != digests[i][j])
+				return 0;
+		}
+	}
+	return 1;
+}
+
+const SHA256_BACKEND *sha256_select_backend(void)
+{
+	size_t i, count = sizeof(backends) / sizeof(backends[0]);
+
+	// A backend is only kept if the CPU has it and it reproduces the known
+	// answers; the C transform is the fallback regardless.
+	for (i = 0; i < count; ++i) {
+		if (!backends[i].supported())
+			continue;
+		active_backend = &backends[i];
+		if (sha256_self_test())
+			break;
+	}
+	if (i == count)
+		active_backend = &backends[count - 1];
+	return active_backend;
+}
+
+// Forces a backend by name, e.g. to benchmark one against another. Returns
+// NULL and keeps the current backend if the CPU lacks it.
+const SHA256_BACKEND *sha256_use_backend(const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(backends) / sizeof(backends[0]); ++i) {
+		if (strcmp(backends[i].name, name) == 0 && backends[i].supported()) {
+			active_backend = &backends[i];
+			return active_backend;
+		}
+	}
+	return NULL;
+}
+
+const SHA256_BACKEND *sha256_get_backend(void)
+{
+	return active_backend ? active_backend : sha256_select_backend();
 }
 
 void sha256_init(SHA256_CTX *ctx)
 {
+	if (!active_backend)
+		sha256_select_backend();
 	ctx->datalen = 0;
 	ctx->bitlen = 0;
 	ctx->state[0] = 0x6a09e667;
@@ -98,17 +343,35 @@ void sha256_init(SHA256_CTX *ctx)
 
 void sha256_update(SHA256_CTX *ctx, const BYTE data[], size_t len)
 {
-	WORD i;
+	size_t fill, blocks;
 
-	for (i = 0; i < len; ++i) {
-		ctx->data[ctx->datalen] = data[i];
-		ctx->datalen++;
-		if (ctx->datalen == 64) {
-			sha256_transform(ctx, ctx->data);
-			ctx->bitlen += 512;
-			ctx->datalen = 0;
+	// Top up a partially filled block first
+	if (ctx->datalen > 0) {
+		fill = 64 - ctx->datalen;
+		if (len < fill) {
+			memcpy(&ctx->data[ctx->datalen], data, len);
+			ctx->datalen += len;
+			return;
 		}
+		memcpy(&ctx->data[ctx->datalen], data, fill);
+		active_backend->transform(ctx->state, ctx->data, 1);
+		ctx->bitlen += 512;
+		ctx->datalen = 0;
+		data += fill;
+		len -= fill;
 	}
+
+	// Whole blocks go straight from the caller's buffer
+	blocks = len / 64;
+	if (blocks > 0) {
+		active_backend->transform(ctx->state, data, blocks);
+		ctx->bitlen += (unsigned long long)blocks * 512;
+		data += blocks * 64;
+		len -= blocks * 64;
+	}
+
+	memcpy(ctx->data, data, len);
+	ctx->datalen = len;
 }
 
 void sha256_final(SHA256_CTX *ctx, BYTE hash[])
@@ -127,7 +390,7 @@ void sha256_final(SHA256_CTX *ctx, BYTE hash[])
 		ctx->data[i++] = 0x80;
 		while (i < 64)
 			ctx->data[i++] = 0x00;
-		sha256_transform(ctx, ctx->data);
+		active_backend->transform(ctx->state, ctx->data, 1);
 		memset(ctx->data, 0, 56);
 	}
 
@@ -141,7 +404,7 @@ void sha256_final(SHA256_CTX *ctx, BYTE hash[])
 	ctx->data[58] = ctx->bitlen >> 40;
 	ctx->data[57] = ctx->bitlen >> 48;
 	ctx->data[56] = ctx->bitlen >> 56;
-	sha256_transform(ctx, ctx->data);
+	active_backend->transform(ctx->state, ctx->data, 1);
 
 	// Since this implementation uses little endian byte ordering and SHA uses big endian,
 	// reverse all the bytes when copying the final state to the output hash.
@@ -155,4 +418,218 @@ void sha256_final(SHA256_CTX *ctx, BYTE hash[])
 		hash[i + 24] = (ctx->state[6] >> (24 - i * 8)) & 0x000000ff;
 		hash[i + 28] = (ctx->state[7] >> (24 - i * 8)) & 0x000000ff;
 	}
-}
\ No newline at end of file
+}
+
+void sha256_padded(const BYTE head[], size_t head_blocks, const BYTE tail[], size_t tail_blocks, BYTE hash[])
+{
+	SHA256_CTX ctx;
+	WORD i;
+
+	sha256_init(&ctx);
+	active_backend->transform(ctx.state, head, head_blocks);
+	active_backend->transform(ctx.state, tail, tail_blocks);
+
+	for (i = 0; i < 4; ++i) {
+		hash[i]      = (ctx.state[0] >> (24 - i * 8)) & 0x000000ff;
+		hash[i + 4]  = (ctx.state[1] >> (24 - i * 8)) & 0x000000ff;
+		hash[i + 8]  = (ctx.state[2] >> (24 - i * 8)) & 0x000000ff;
+		hash[i + 12] = (ctx.state[3] >> (24 - i * 8)) & 0x000000ff;
+		hash[i + 16] = (ctx.state[4] >> (24 - i * 8)) & 0x000000ff;
+		hash[i + 20] = (ctx.state[5] >> (24 - i * 8)) & 0x000000ff;
+		hash[i + 24] = (ctx.state[6] >> (24 - i * 8)) & 0x000000ff;
+		hash[i + 28] = (ctx.state[7] >> (24 - i * 8)) & 0x000000ff;
+	}
+}
+
+/*********************** MULTI-BUFFER HASHING ***********************/
+// Lane width is picked at compile time: 8 with AVX2, 4 with SSE2 or NEON.
+// Builds without a vector unit (such as the Pi's ARM1176) hash serially.
+#if defined(__AVX2__)
+#define SHA256_LANES 8
+typedef __m256i LANE_VEC;
+#define V_ADD(a,b) _mm256_add_epi32(a,b)
+#define V_XOR(a,b) _mm256_xor_si256(a,b)
+#define V_AND(a,b) _mm256_and_si256(a,b)
+#define V_OR(a,b) _mm256_or_si256(a,b)
+#define V_ANDNOT(a,b) _mm256_andnot_si256(a,b)	// ~a & b
+#define V_SHR(a,n) _mm256_srli_epi32(a,n)
+#define V_SHL(a,n) _mm256_slli_epi32(a,n)
+#define V_SET1(x) _mm256_set1_epi32((int)(x))
+#define V_LOAD(p) _mm256_loadu_si256((const __m256i *)(p))
+#define V_STORE(p,v) _mm256_storeu_si256((__m256i *)(p), v)
+#elif defined(__SSE2__)
+#define SHA256_LANES 4
+typedef __m128i LANE_VEC;
+#define V_ADD(a,b) _mm_add_epi32(a,b)
+#define V_XOR(a,b) _mm_xor_si128(a,b)
+#define V_AND(a,b) _mm_and_si128(a,b)
+#define V_OR(a,b) _mm_or_si128(a,b)
+#define V_ANDNOT(a,b) _mm_andnot_si128(a,b)	// ~a & b
+#define V_SHR(a,n) _mm_srli_epi32(a,n)
+#define V_SHL(a,n) _mm_slli_epi32(a,n)
+#define V_SET1(x) _mm_set1_epi32((int)(x))
+#define V_LOAD(p) _mm_loadu_si128((const __m128i *)(p))
+#define V_STORE(p,v) _mm_storeu_si128((__m128i *)(p), v)
+#elif defined(__ARM_NEON)
+#define SHA256_LANES 4
+typedef uint32x4_t LANE_VEC;
+#define V_ADD(a,b) vaddq_u32(a,b)
+#define V_XOR(a,b) veorq_u32(a,b)
+#define V_AND(a,b) vandq_u32(a,b)
+#define V_OR(a,b) vorrq_u32(a,b)
+#define V_ANDNOT(a,b) vbicq_u32(b,a)	// ~a & b
+#define V_SHR(a,n) vshrq_n_u32(a,n)
+#define V_SHL(a,n) vshlq_n_u32(a,n)
+#define V_SET1(x) vdupq_n_u32(x)
+#define V_LOAD(p) vld1q_u32((const uint32_t *)(p))
+#define V_STORE(p,v) vst1q_u32((uint32_t *)(p), v)
+#else
+#define SHA256_LANES 1
+#endif
+
+#if SHA256_LANES > 1
+#define V_ROTR(a,n) V_OR(V_SHR(a,n), V_SHL(a,32-(n)))
+#define V_CH(x,y,z) V_XOR(V_AND(x,y), V_ANDNOT(x,z))
+#define V_MAJ(x,y,z) V_XOR(V_XOR(V_AND(x,y), V_AND(x,z)), V_AND(y,z))
+#define V_EP0(x) V_XOR(V_XOR(V_ROTR(x,2), V_ROTR(x,13)), V_ROTR(x,22))
+#define V_EP1(x) V_XOR(V_XOR(V_ROTR(x,6), V_ROTR(x,11)), V_ROTR(x,25))
+#define V_SIG0(x) V_XOR(V_XOR(V_ROTR(x,7), V_ROTR(x,18)), V_SHR(x,3))
+#define V_SIG1(x) V_XOR(V_XOR(V_ROTR(x,17), V_ROTR(x,19)), V_SHR(x,10))
+
+// Runs one compression over a 64 byte block from each lane. Lane l of every
+// vector holds the state of the message whose block starts at data[l].
+static void sha256_transform_lanes(LANE_VEC state[8], const BYTE *data[SHA256_LANES])
+{
+	WORD words[SHA256_LANES];
+	LANE_VEC a, b, c, d, e, f, g, h, t1, t2, m[16];
+	int i, l;
+
+	// Transpose the big endian message words so each vector holds one word
+	// position across all lanes.
+	for (i = 0; i < 16; ++i) {
+		for (l = 0; l < SHA256_LANES; ++l) {
+			const BYTE *p = data[l] + i * 4;
+			words[l] = ((WORD)p[0] << 24) | ((WORD)p[1] << 16) | ((WORD)p[2] << 8) | (WORD)p[3];
+		}
+		m[i] = V_LOAD(words);
+	}
+
+	a = state[0];
+	b = state[1];
+	c = state[2];
+	d = state[3];
+	e = state[4];
+	f = state[5];
+	g = state[6];
+	h = state[7];
+
+	for (i = 0; i < 64; ++i) {
+		if (i >= 16)
+			m[i & 15] = V_ADD(V_ADD(V_SIG1(m[(i - 2) & 15]), m[(i - 7) & 15]),
+			                  V_ADD(V_SIG0(m[(i - 15) & 15]), m[i & 15]));
+		t1 = V_ADD(V_ADD(V_ADD(h, V_EP1(e)), V_ADD(V_CH(e,f,g), V_SET1(k[i]))), m[i & 15]);
+		t2 = V_ADD(V_EP0(a), V_MAJ(a,b,c));
+		h = g;
+		g = f;
+		f = e;
+		e = V_ADD(d, t1);
+		d = c;
+		c = b;
+		b = a;
+		a = V_ADD(t1, t2);
+	}
+
+	state[0] = V_ADD(state[0], a);
+	state[1] = V_ADD(state[1], b);
+	state[2] = V_ADD(state[2], c);
+	state[3] = V_ADD(state[3], d);
+	state[4] = V_ADD(state[4], e);
+	state[5] = V_ADD(state[5], f);
+	state[6] = V_ADD(state[6], g);
+	state[7] = V_ADD(state[7], h);
+}
+
+// Hashes exactly SHA256_LANES messages of the same length side by side.
+static void sha256_lanes(const BYTE *msgs[SHA256_LANES], size_t len, BYTE *out[SHA256_LANES])
+{
+	static const WORD init[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+		0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+	LANE_VEC state[8];
+	const BYTE *blocks[SHA256_LANES];
+	BYTE tail[SHA256_LANES][128];
+	WORD words[SHA256_LANES];
+	unsigned long long bitlen = (unsigned long long)len * 8;
+	size_t full = len / 64, rem = len % 64, tail_len = (rem < 56) ? 64 : 128;
+	size_t i;
+	int l;
+
+	for (i = 0; i < 8; ++i)
+		state[i] = V_SET1(init[i]);
+
+	for (i = 0; i < full; ++i) {
+		for (l = 0; l < SHA256_LANES; ++l)
+			blocks[l] = msgs[l] + i * 64;
+		sha256_transform_lanes(state, blocks);
+	}
+
+	// Every message has the same length, so the padding lands in the same
+	// place in each lane's final one or two blocks.
+	for (l = 0; l < SHA256_LANES; ++l) {
+		memcpy(tail[l], msgs[l] + full * 64, rem);
+		tail[l][rem] = 0x80;
+		memset(&tail[l][rem + 1], 0, tail_len - rem - 1);
+		for (i = 0; i < 8; ++i)
+			tail[l][tail_len - 1 - i] = bitlen >> (i * 8);
+	}
+	for (i = 0; i < tail_len; i += 64) {
+		for (l = 0; l < SHA256_LANES; ++l)
+			blocks[l] = &tail[l][i];
+		sha256_transform_lanes(state, blocks);
+	}
+
+	for (i = 0; i < 8; ++i) {
+		V_STORE(words, state[i]);
+		for (l = 0; l < SHA256_LANES; ++l) {
+			out[l][i * 4]     = words[l] >> 24;
+			out[l][i * 4 + 1] = words[l] >> 16;
+			out[l][i * 4 + 2] = words[l] >> 8;
+			out[l][i * 4 + 3] = words[l];
+		}
+	}
+}
+#endif
+
+void sha256_many(const BYTE *msgs[], size_t len, BYTE *out[], size_t n)
+{
+	size_t i = 0;
+	SHA256_CTX ctx;
+
+#if SHA256_LANES > 1
+	const BYTE *lane_msgs[SHA256_LANES];
+	BYTE *lane_out[SHA256_LANES];
+	BYTE scratch[SHA256_BLOCK_SIZE];
+	int l;
+
+	// Hardware rounds on one message beat software rounds across lanes, so
+	// the lanes are only used when the C transform is selected.
+	if (sha256_get_backend()->transform == sha256_transform_c) {
+		for ( ; i < n; i += SHA256_LANES) {
+			// Idle lanes of a short final group rehash the last message into scratch
+			for (l = 0; l < SHA256_LANES; ++l) {
+				int in_range = i + l < n;
+				lane_msgs[l] = msgs[in_range ? i + l : n - 1];
+				lane_out[l] = in_range ? out[i + l] : scratch;
+			}
+			sha256_lanes(lane_msgs, len, lane_out);
+		}
+	}
+#endif
+
+	for ( ; i < n; ++i) {
+		sha256_init(&ctx);
+		sha256_update(&ctx, msgs[i], len);
+		sha256_final(&ctx, out[i]);
+	}
+}
@@ -26,9 +26,32 @@ typedef struct {
 	WORD state[8];
 } SHA256_CTX;
 
+// A compression function implementation. transform runs `blocks` consecutive
+// 64 byte blocks from data through state.
+typedef struct {
+	const char *name;
+	int (*supported)(void);
+	void (*transform)(WORD state[8], const BYTE data[], size_t blocks);
+} SHA256_BACKEND;
+
 /*********************** FUNCTION DECLARATIONS **********************/
+// Picks the fastest backend the CPU supports that passes a known-answer
+// self-test. sha256_init calls this on first use.
+const SHA256_BACKEND *sha256_select_backend(void);
+const SHA256_BACKEND *sha256_get_backend(void);
+const SHA256_BACKEND *sha256_use_backend(const char *name);
+
 void sha256_init(SHA256_CTX *ctx);
 void sha256_update(SHA256_CTX *ctx, const BYTE data[], size_t len);
 void sha256_final(SHA256_CTX *ctx, BYTE hash[]);
 
+// Hashes a message the caller has already padded: head_blocks whole blocks
+// read in place from head, then tail_blocks blocks from tail ending in the
+// 0x80 byte, zeros and bit length.
+void sha256_padded(const BYTE head[], size_t head_blocks, const BYTE tail[], size_t tail_blocks, BYTE hash[]);
+
+// Hashes n independent messages of len bytes each, writing msgs[i]'s digest
+// to out[i]. Messages are interleaved across SIMD lanes where available.
+void sha256_many(const BYTE *msgs[], size_t len, BYTE *out[], size_t n);
+
 #endif   // SHA256_H
\ No newline at end of file
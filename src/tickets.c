@@ -1,27 +1,90 @@
-#include <stdio.h>
+#include "tickets.h"
+#include "malloc.h"
 #include "strings.h"
-#include <stdlib.h>
-#include <stdbool.h>
-
-typedef struct {
-    unsigned char hash[32];
-    unsigned char used;
-} ticket;
-
-#define TICKET_SIZE 33
-#define MAX_TICKET 100
-static ticket tickets[TICKET_SIZE * MAX_TICKET];
-static size_t tickets_len = 0;
-
-// Initialize Vote
-// At the start, no votes
-
-// 
-void vote_init() { }
-
-// 
-void add_voting_ticket(unsigned char* hash) {
-    if (tickets_len >= MAX_TICKET) return;
-    tickets[tickets_len].used = 0;
-    tickets[tickets_len].hash =
-}
\ No newline at end of file
+
+/*
+ * The slot table only holds ticket numbers, 4 bytes a slot, and is kept at
+ * most half full. Passphrase hashes are SHA-256 output, so their first bytes
+ * are already uniform and pick the home slot directly.
+ */
+
+static size_t home_slot(ticket_store * store, const unsigned char * hash) {
+    size_t key = ((size_t) hash[0] << 24) | (hash[1] << 16) | (hash[2] << 8) | hash[3];
+    return key & (store->capacity - 1);
+}
+
+static bool same_hash(const unsigned char * left, const unsigned char * right) {
+    for (int i = 0; i < 32; i++) {
+        if (left[i] != right[i]) return false;
+    }
+    return true;
+}
+
+bool ticket_store_init(ticket_store * store, size_t roster_size) {
+    size_t capacity = 1;
+    while (capacity < roster_size * 2) capacity <<= 1;
+    size_t used_words = (roster_size + 31) / 32;
+
+    store->slots = malloc(capacity * sizeof(uint32_t));
+    store->hashes = malloc(roster_size * 32);
+    store->profiles = malloc(roster_size * sizeof(keystroke_profile));
+    store->names = malloc(roster_size * TICKET_NAME_SIZE);
+    store->used = malloc(used_words * sizeof(uint32_t));
+    store->num_tickets = 0;
+    if (store->slots == NULL || store->hashes == NULL || store->profiles == NULL ||
+        store->names == NULL || store->used == NULL) {
+        free(store->slots);
+        free(store->hashes);
+        free(store->profiles);
+        free(store->names);
+        free(store->used);
+        store->slots = NULL;
+        store->capacity = 0;
+        store->max_tickets = 0;
+        return false;
+    }
+
+    store->capacity = capacity;
+    store->max_tickets = roster_size;
+    memset(store->slots, 0, capacity * sizeof(uint32_t));
+    memset(store->used, 0, used_words * sizeof(uint32_t));
+    return true;
+}
+
+// Probes from the hash's home slot to either its ticket or the first free slot
+static uint32_t * probe(ticket_store * store, const unsigned char * hash) {
+    size_t mask = store->capacity - 1;
+    for (size_t i = home_slot(store, hash);; i = (i + 1) & mask) {
+        uint32_t * slot = &store->slots[i];
+        if (*slot == 0 || same_hash(store->hashes[*slot - 1], hash)) return slot;
+    }
+}
+
+int ticket_store_add(ticket_store * store, const unsigned char * hash) {
+    if (store->num_tickets >= store->max_tickets) return -1;
+
+    uint32_t * slot = probe(store, hash);
+    if (*slot != 0) return -1;
+
+    int ticket = store->num_tickets++;
+    *slot = ticket + 1;
+    memcpy(store->hashes[ticket], hash, 32);
+    memset(&store->profiles[ticket], 0, sizeof(keystroke_profile));
+    store->names[ticket][0] = '\0';
+    return ticket;
+}
+
+int ticket_store_find(ticket_store * store, const unsigned char * hash) {
+    if (store->capacity == 0) return -1;
+
+    uint32_t * slot = probe(store, hash);
+    return (int) *slot - 1;
+}
+
+bool ticket_used(ticket_store * store, int ticket) {
+    return (store->used[ticket / 32] >> (ticket % 32)) & 1;
+}
+
+void ticket_mark_used(ticket_store * store, int ticket) {
+    store->used[ticket / 32] |= 1u << (ticket % 32);
+}
@@ -0,0 +1,47 @@
+#ifndef TICKETS_H
+#define TICKETS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "keystroke.h"
+
+/*
+ * Registered vote tickets, keyed by the SHA-256 of the passphrase. Tickets
+ * are numbered in registration order and each field is kept in its own
+ * array, so authenticating reads one hash and one packed keystroke
+ * profile.
+ */
+
+#define TICKET_NAME_SIZE 20
+
+typedef struct {
+    uint32_t * slots; // Open addressing, ticket + 1 or 0 if empty
+    size_t capacity; // Always a power of two
+    unsigned char (* hashes)[32]; // SHA-256 of each passphrase
+    keystroke_profile * profiles;
+    char (* names)[TICKET_NAME_SIZE];
+    uint32_t * used; // Bit per ticket, set once it has voted
+    size_t num_tickets;
+    size_t max_tickets; // Roster size
+} ticket_store;
+
+// Allocates room for roster_size tickets up front, nothing grows later
+bool ticket_store_init(ticket_store * store, size_t roster_size);
+
+// Returns the new ticket for this passphrase hash, or -1 if the roster is
+// full or the passphrase is already registered
+int ticket_store_add(ticket_store * store, const unsigned char * hash);
+
+// Returns the ticket registered with this passphrase hash, or -1
+int ticket_store_find(ticket_store * store, const unsigned char * hash);
+
+bool ticket_used(ticket_store * store, int ticket);
+
+void ticket_mark_used(ticket_store * store, int ticket);
+
+#define ticket_hash(store, ticket) ((store)->hashes[ticket])
+#define ticket_profile(store, ticket) (&(store)->profiles[ticket])
+#define ticket_name(store, ticket) ((store)->names[ticket])
+
+#endif
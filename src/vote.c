@@ -11,55 +11,103 @@
 #include <stdarg.h>
 #include "sha256.h"
 #include "interrupts.h"
+#include "timer.h"
 
 // Project Imports
 #include "screen.h"
-
-typedef struct {
-    unsigned char hash[32];
-    unsigned char used;
-    unsigned int* intervals;
-    char name[20];
-} ticket;
+#include "cert_index.h"
+#include "tickets.h"
+#include "keystroke.h"
+#include "arena.h"
+#include "vote_log.h"
+#include "leaf_store.h"
 
 #define MAX_PASS 30
-#define TICKET_SIZE 33
+// Voters on the roster, about 320 bytes of RAM each
+#ifndef MAX_TICKET
 #define MAX_TICKET 100
-#define CERT_SIZE 6
-#define BUFFER_SIZE 40
+#endif
+#define CERT_SIZE (CERT_PREFIX_BYTES * 2)
+#define MAX_CERT_MATCHES 8
 #define ERROR_SIZE 40
+#define REQUEST_ARENA_SIZE 1024
+#ifndef VOTE_LOG_PATH
+#define VOTE_LOG_PATH "votes.log"
+#endif
+#ifndef VOTE_SNAPSHOT_PATH
+#define VOTE_SNAPSHOT_PATH "votes.snap" // Written as votes.snap.0 and votes.snap.1
+#endif
+#ifndef SNAPSHOT_INTERVAL
+#define SNAPSHOT_INTERVAL 256 // Journal records between snapshots
+#endif
 
 // Tickets
-static ticket tickets[TICKET_SIZE * MAX_TICKET];
-static size_t ticket_iter = 0;
+static ticket_store tickets;
 static int selected_ticket = -1;
+static keystroke_config keystroke_settings;
 static int selected_cert = 2;
 static bool empty_proof = false;
 
 // Votes
-static leaf vote_leafs[30];
+static leaf_store vote_leafs;
 static vote_merkle *vote_merkle_tree;
 static int nonce;
 static size_t vote_iter = 0;
 static node *curr_merkle_proof;
+static cert_index vote_certs;
+
+// Journal of registrations and votes, replayed at startup
+enum { LOG_TICKET = 1, LOG_VOTE = 2 };
+
+typedef struct {
+    unsigned char hash[32];
+    char name[TICKET_NAME_SIZE];
+    keystroke_profile profile;
+} ticket_record;
+
+typedef struct {
+    uint32_t ticket;
+    leaf vote_leaf;
+} vote_record;
+
+static log_device journal_device;
+static vote_log journal;
+
+// Snapshots alternate between the two devices. A snapshot holds this, then
+// the ticket store's arrays, the vote leaves and the tree's rows.
+typedef struct {
+    uint32_t max_tickets;
+    uint32_t capacity;
+    uint32_t num_tickets;
+    uint32_t num_votes;
+    int32_t nonce;
+    uint32_t candidates;
+} election_state;
+
+static log_device snapshot_devices[2];
+static int snapshot_slot = 0; // Device the next snapshot is written to
+static uint64_t snapshot_seq = 0; // Journal records the latest snapshot covers
+
+// Scratch memory for the screen being handled, reset when the next one
+// starts
+static arena request_arena;
 
 // Current Selected Password
 static char curr_pass[MAX_PASS] = "";
-static char current_cert[CERT_SIZE] = "";
-static char cert_input[CERT_SIZE] = "";
+static char current_cert[CERT_SIZE + 1] = "";
+static char cert_input[CERT_SIZE + 1] = "";
 static char voter_name[MAX_PASS] = "";
 static char admin_input[MAX_PASS] = "";
 static char admin_pass[MAX_PASS] = "";
 static char pass_error[ERROR_SIZE] = "";
 static char success_phrase[ERROR_SIZE] = "";
 
-static unsigned int last_time = 0;
 
-void add_ticket(const char * pass, unsigned int * intervals);
+bool add_ticket(const char * pass, keystroke_enrollment * enrollment);
 void init_voting(void);
 void handle_event(void);
 void move(unsigned int direction);
-bool vote(ticket *vote_ticket, int candidate);
+bool vote(int vote_ticket, int candidate);
 
 /*
  * Main
@@ -76,60 +124,72 @@ void main(void)
  * TICKET FUNCTIONS
  */
 
-int check_cert(char * cert) {
-    char cert_bytes[(strlen(cert) + 1) / 2];
-    hex_to_bytes(cert, cert_bytes, CERT_SIZE);
+// Fills matches with the leaves whose certificate is cert, lowest first, and
+// returns how many leaves have it. Several leaves can share a certificate.
+int check_cert(char * cert, int * matches, int max_matches) {
+    if (strlen(cert) != CERT_SIZE) return 0;
+    char cert_bytes[CERT_PREFIX_BYTES];
+    if (!hex_to_bytes(cert, cert_bytes, CERT_SIZE)) return 0;
 
-    unsigned int merkle_height = vote_merkle_tree->height;
-    unsigned int num_leaf = 1 << merkle_height;
+    return cert_index_find(&vote_certs, cert_bytes, matches, max_matches);
+}
 
-    for (int leaf_index = 0; leaf_index < num_leaf; leaf_index++) {
-        node* curr = &vote_merkle_tree->nodes[num_leaf - 1 + leaf_index];
-        if (cmp((char *) curr, cert_bytes, CERT_SIZE / 2)) {
-            return leaf_index;
-        }
-    }
-    return -1;
+// Frees the previous screen's scratch memory
+static void start_request(void) {
+    arena_reset(&request_arena);
+    curr_merkle_proof = NULL;
+}
+
+// Proof of a leaf, valid until the next screen is handled
+static node * request_merkle_proof(size_t leaf_index) {
+    node * proof = arena_alloc(&request_arena, NODE_SIZE * vote_merkle_tree->height);
+    if (proof != NULL) fill_merkle_proof(vote_merkle_tree, leaf_index, proof);
+    return proof;
 }
 
 // Checks for valid vote ticket
-int check_ticket(const char * pass, unsigned int * intervals) {
+int check_ticket(const char * pass, keystroke_stream * typing) {
     char hash_pass[32];
     SHA256(pass, strlen(pass), hash_pass);
-    // SHA256((const unsigned char*) pass, strlen(hash_pass), hash_pass);
-    for (int i = 0; i < ticket_iter; i++) {
-        // Checks if the hashes (sentences) match
-        if (!(tickets[i].used == 0 && cmp((char *) tickets[i].hash, hash_pass, 32))) {
-            continue;
-        }
+    // Passphrases are unique, so the hash names at most one ticket
+    int found = ticket_store_find(&tickets, (unsigned char *) hash_pass);
+    if (found == -1 || ticket_used(&tickets, found)) return -1;
 
-        // Check whether RMS is within acceptable threshold
-        int iter_max = (strlen(pass) - 1 > BUFFER_SIZE) ? BUFFER_SIZE : strlen(pass) - 1;
-        unsigned int squared_error = 0;
-        unsigned int THRESHOLD = 10000;
-        for (int j = 0; j < iter_max; j++) {
-            squared_error += intervals[j] * tickets[i].intervals[j];
-        }
-        if (squared_error < THRESHOLD * iter_max) {
-            return i;
-        }
-    }
+    // Check the phrase was typed like it was at registration
+    if (!keystroke_match(ticket_profile(&tickets, found), typing, &keystroke_settings)) return -1;
+    return found;
+}
+
+// Applies a registration, live or replayed from the journal
+static int apply_ticket(const ticket_record * record) {
+    int new_ticket = ticket_store_add(&tickets, record->hash);
+    if (new_ticket == -1) return -1;
 
-    return -1;
+    memcpy(ticket_name(&tickets, new_ticket), record->name, TICKET_NAME_SIZE);
+    *ticket_profile(&tickets, new_ticket) = record->profile;
+    return new_ticket;
 }
 
-void create_ticket(const char * pass, ticket * new_ticket, unsigned int * intervals) {
-    char hash[32];
-    SHA256(pass, strlen(pass), hash);
-    new_ticket->used = 0; 
-    memcpy(new_ticket->hash, hash, 32);
-    new_ticket->intervals = intervals;
-    memcpy(new_ticket->name, voter_name, strlen(voter_name));
-    new_ticket->name[strlen(voter_name)] = '\0';
+bool add_ticket(const char * pass, keystroke_enrollment * enrollment) {
+    ticket_record * record = arena_alloc(&request_arena, sizeof(ticket_record));
+    if (record == NULL) return false;
+    SHA256(pass, strlen(pass), (char *) record->hash);
+    if (ticket_store_find(&tickets, record->hash) != -1) return false;
+
+    keystroke_enroll_finish(enrollment, &keystroke_settings, &record->profile);
+    size_t name_len = strlen(voter_name);
+    if (name_len >= TICKET_NAME_SIZE) name_len = TICKET_NAME_SIZE - 1;
+    memset(record->name, 0, TICKET_NAME_SIZE);
+    memcpy(record->name, voter_name, name_len);
+
+    // Journal first, so a ticket that's handed out always survives a restart
+    if (!vote_log_append(&journal, LOG_TICKET, record, sizeof(ticket_record), timer_get_ticks())) return false;
+    return apply_ticket(record) != -1;
 }
 
-void add_ticket(const char * pass, unsigned int * intervals) {
-    create_ticket(pass, &tickets[ticket_iter++], intervals);
+static char * selected_name(void) {
+    static char no_name[1] = "";
+    return selected_ticket != -1 ? ticket_name(&tickets, selected_ticket) : no_name;
 }
 
 /*
@@ -141,10 +201,10 @@ void draw_screen(void) {
             draw_home_screen();
             break;
         case Auth:
-            draw_auth_screen(curr_pass, pass_error, tickets[selected_ticket].name);
+            draw_auth_screen(curr_pass, pass_error, selected_name());
             break;
         case Vote:
-            draw_vote_screen(tickets[selected_ticket].name);
+            draw_vote_screen(selected_name());
             break;
         case Admin:
             draw_admin_screen(voter_name, admin_input, success_phrase);
@@ -159,7 +219,7 @@ void draw_screen(void) {
             draw_fraud_visual_screen(curr_merkle_proof, vote_merkle_tree, selected_cert, empty_proof);
             break;
         case Results:
-            printf("new vote: %d", vote_iter);
+            printf("new vote: %d", (int) vote_iter);
             draw_results_screen(vote_iter, vote_merkle_tree);
             break;
         case AdminLogin:
@@ -169,8 +229,6 @@ void draw_screen(void) {
     gl_swap_buffer();
 }
 
-#define num_leaves(tree) (1 << tree->height )
-
 void handle_event() {
     switch (get_selected()) {
         case Back:
@@ -187,11 +245,10 @@ void handle_event() {
             break;
         case SubmitBox:
             if (get_selected_candidate() == -1) break;
-            vote(&tickets[selected_ticket], (get_selected_candidate() == Candidate1 ? 0 : 1));
-            free(vote_merkle_tree);
-            vote_merkle_tree = create_merkle_tree(vote_leafs, vote_iter);
+            if (!vote(selected_ticket, (get_selected_candidate() == Candidate1 ? 0 : 1))) break;
+            node* cert_node = get_merkle_node(vote_merkle_tree, 0, vote_iter - 1);
             switch_screen(Certificate, CertificateBox);
-            bytes_to_hex((char *) &vote_merkle_tree->nodes[num_leaves(vote_merkle_tree) + vote_iter - 2], current_cert, CERT_SIZE / 2);
+            bytes_to_hex((char *) cert_node, current_cert, CERT_SIZE / 2);
             break;
         case CertificateBox:
             switch_screen(Home, AdminBox);
@@ -237,25 +294,49 @@ void handle_move_screen(unsigned int key) {
     }
 }
 
+// Reads the next key press, timing the phrase's presses and releases on
+// the way. Backspace, Enter and Escape aren't part of the phrase.
+key_out_t read_timed_key(keystroke_stream * typing) {
+    while (1) {
+        key_out_t key_out = keyboard_read_key();
+        if (key_out.release) {
+            keystroke_stream_release(typing, key_out.keycode, key_out.time);
+            continue;
+        }
+        if (key_out.elem != '\b' && key_out.elem != '\n' && key_out.elem != PS2_KEY_ESC) {
+            keystroke_stream_press(typing, key_out.keycode, key_out.time);
+        }
+        return key_out;
+    }
+}
+
 unsigned char keyboard_read_next_char() {
     key_out_t key = keyboard_read_next();
     return key.elem;
 }
 
 void handle_auth_screen() {
+    start_request();
+
     // Clear previous passcode
     memset(curr_pass, '\0', MAX_PASS);
-    draw_auth_screen(curr_pass, pass_error, tickets[selected_ticket].name);
+    draw_auth_screen(curr_pass, pass_error, selected_name());
     gl_swap_buffer();
-    draw_auth_screen(curr_pass, pass_error, tickets[selected_ticket].name);
+    draw_auth_screen(curr_pass, pass_error, selected_name());
 
     unsigned int i = 0;
-    key_out_t key_out = keyboard_read_next();
+    keystroke_stream * typing = arena_alloc(&request_arena, sizeof(keystroke_stream));
+    if (typing == NULL) {
+        // Shown until a key is pressed, then the screen starts over
+        snprintf(pass_error, ERROR_SIZE, "Out of memory, try again");
+        draw_auth_screen(curr_pass, pass_error, selected_name());
+        gl_swap_buffer();
+        keyboard_read_next();
+        return;
+    }
+    keystroke_stream_init(typing);
+    key_out_t key_out = read_timed_key(typing);
     char key = key_out.elem;
-    last_time = key_out.time;
-
-    unsigned int * intervals = malloc(BUFFER_SIZE * 4);
-    size_t int_iter = 0;
 
     unsigned int x = (unsigned int) em(25);
     unsigned int y = (unsigned int) em(30);
@@ -279,15 +360,12 @@ void handle_auth_screen() {
                 x += char_width;
             }
         }
-        key_out = keyboard_read_next();
+        key_out = read_timed_key(typing);
         key = key_out.elem;
-        if (key != '\b' && key != '\n') {
-            intervals[int_iter++] = (key_out.time - last_time) / 1000;
-         }
-        last_time = key_out.time;
     }
+    keystroke_stream_finish(typing, key_out.time);
     curr_pass[i] = '\0';
-    selected_ticket = check_ticket(curr_pass, intervals);
+    selected_ticket = check_ticket(curr_pass, typing);
     if (selected_ticket != -1) {
         switch_screen(Vote, Back);
         set_selected_candidate(None);
@@ -300,6 +378,8 @@ void handle_auth_screen() {
 }
 
 void handle_fraud_screen() {
+    start_request();
+
     // Clear previous passcode
     memset(cert_input, '\0', CERT_SIZE);
     draw_fraud_proof_screen(cert_input);
@@ -313,7 +393,7 @@ void handle_fraud_screen() {
             if (i != 0) cert_input[--i] = '\0';
         } else if (key == '\t') {
             selected_cert = vote_iter;
-            curr_merkle_proof = create_merkle_proof(vote_merkle_tree, vote_iter);
+            curr_merkle_proof = request_merkle_proof(vote_iter);
             empty_proof = true;
             switch_screen(Merkle, MerkleBox);
             memset(cert_input, '\0', CERT_SIZE);
@@ -325,9 +405,14 @@ void handle_fraud_screen() {
         gl_swap_buffer();
         key = keyboard_read_next_char();
     }
-    selected_cert = check_cert(cert_input);
+    int matches[MAX_CERT_MATCHES];
+    int num_matches = check_cert(cert_input, matches, MAX_CERT_MATCHES);
+    selected_cert = num_matches > 0 ? matches[0] : -1;
+    if (num_matches > 1) {
+        printf("Certificate %s matches %d votes, showing the first\n", cert_input, num_matches);
+    }
     if (selected_cert != -1) {
-        curr_merkle_proof = create_merkle_proof(vote_merkle_tree, selected_cert);
+        curr_merkle_proof = request_merkle_proof(selected_cert);
     }
 
     switch_screen(Merkle, MerkleBox);
@@ -368,6 +453,8 @@ void handle_admin_auth_screen() {
 }
 
 void handle_admin_screen() {
+    start_request();
+
     // Clear previous passcode
     memset(admin_input, '\0', MAX_PASS);
     memset(voter_name, '\0', MAX_PASS);
@@ -413,15 +500,21 @@ void handle_admin_screen() {
     }
     voter_name[i] = '\0';
 
+    keystroke_stream * typing = arena_alloc(&request_arena, sizeof(keystroke_stream));
+    keystroke_enrollment * enrollment = arena_alloc(&request_arena, sizeof(keystroke_enrollment));
+    char * first_phrase = arena_alloc(&request_arena, MAX_PASS);
+    if (typing == NULL || enrollment == NULL || first_phrase == NULL) {
+        snprintf(success_phrase, ERROR_SIZE, "Out of memory, try again");
+        return;
+    }
+    keystroke_enroll_init(enrollment);
+
     reset:
 
+    keystroke_stream_init(typing);
     i = 0;
-    key_out = keyboard_read_next();
+    key_out = read_timed_key(typing);
     key = key_out.elem;
-    last_time = key_out.time;
-
-    unsigned int * intervals = malloc(BUFFER_SIZE * 4);
-    size_t int_iter = 0;
 
     x = (unsigned int) em(25);
     y = (unsigned int) em(50);
@@ -451,52 +544,250 @@ void handle_admin_screen() {
             }
         }
 
-        key_out = keyboard_read_next();
+        key_out = read_timed_key(typing);
         key = key_out.elem;
-        if (key != '\b' && key != '\n') {
-            intervals[int_iter++] = (key_out.time - last_time) / 1000;
-         }
-        last_time = key_out.time;
     }
+    keystroke_stream_finish(typing, key_out.time);
     admin_input[i] = '\0';
 
     printf("%s\n", admin_input);
-    printf("%d %d\n", strlen(admin_input), int_iter);
-    printf("%d", intervals[0]);
-    
+    printf("%d %d\n", (int) strlen(admin_input), (int) typing->num_keys);
+
+    // The phrase is typed KEYSTROKE_SAMPLES times to learn how the voter types it
+    if (enrollment->num_samples == 0) memcpy(first_phrase, admin_input, MAX_PASS);
+    if (strcmp(first_phrase, admin_input) != 0 || !keystroke_enroll_add(enrollment, typing)) {
+        keystroke_enroll_init(enrollment);
+        snprintf(success_phrase, ERROR_SIZE, "Phrases differ, start again");
+    } else if (enrollment->num_samples < KEYSTROKE_SAMPLES) {
+        snprintf(success_phrase, ERROR_SIZE, "Type it again (%d of %d)", enrollment->num_samples + 1, KEYSTROKE_SAMPLES);
+    }
+    if (enrollment->num_samples < KEYSTROKE_SAMPLES) {
+        admin_input[0] = '\0';
+        draw_admin_screen(voter_name, admin_input, success_phrase);
+        gl_swap_buffer();
+        draw_admin_screen(voter_name, admin_input, success_phrase);
+        goto reset;
+    }
+
     draw_admin_screen(voter_name, admin_input, success_phrase);
     gl_swap_buffer();
 
-    memcpy(success_phrase, "Registration success", strlen("Registration success"));
-    success_phrase[strlen("Registration success")] = '\0';
-    add_ticket((const char *) admin_input, intervals);
+    const char * result = add_ticket((const char *) admin_input, enrollment) ? "Registration success" : "Registration failed";
+    memcpy(success_phrase, result, strlen(result));
+    success_phrase[strlen(result)] = '\0';
  }
 
-bool vote(ticket* vote_ticket, int candidate) {
-    if (candidate != 1 && candidate != 0) return false;
-    if (vote_ticket->used == 1) return false;
+// Room for one more vote in the leaves, the tree and the certificate
+// index, so applying it can't fail halfway
+static bool reserve_vote(void) {
+    return leaf_store_reserve(&vote_leafs, vote_iter + 1) && reserve_merkle_leaf(vote_merkle_tree) &&
+           cert_index_reserve(&vote_certs, vote_iter + 1);
+}
+
+// Applies a vote, live or replayed from the journal, adding its leaf to the
+// tree. A ticket only ever counts once.
+static bool apply_vote(const vote_record * record) {
+    if (record->ticket >= tickets.num_tickets) return false;
+    if (ticket_used(&tickets, record->ticket)) return false;
+    if (!reserve_vote()) return false;
+
+    leaf * vote_leaf = leaf_store_append(&vote_leafs, &record->vote_leaf);
+    node * cert_node = append_merkle_leaf(vote_merkle_tree, vote_leaf);
+    cert_index_add(&vote_certs, (char *) cert_node);
+    vote_iter++;
+    ticket_mark_used(&tickets, record->ticket);
+    nonce++;
+    return true;
+}
+
+bool vote(int vote_ticket, int candidate) {
+    if (candidate < 0 || candidate >= MERKLE_CANDIDATES) return false;
+    if (ticket_used(&tickets, vote_ticket)) return false;
 
-    // Add vote leaf
-    leaf * vote_leaf = &vote_leafs[vote_iter++];
-    printf("new vote: %d", vote_iter);
-    SHA256((const char *) &nonce, 4, vote_leaf->randomness); nonce++;
+    // Build vote leaf
+    vote_record record;
+    record.ticket = vote_ticket;
+    leaf * vote_leaf = &record.vote_leaf;
+    SHA256((const char *) &nonce, 4, vote_leaf->randomness);
     memset(vote_leaf->sig, 0, 32);
-    memcpy(vote_leaf->hash, vote_ticket->hash, 32);
+    memcpy(vote_leaf->hash, ticket_hash(&tickets, vote_ticket), 32);
     vote_leaf->vote = (char) candidate;
 
-    // Use ticket
-    vote_ticket->used = 1;
+    // Journal, then add the leaf and use the ticket. Room for the leaf is
+    // made first so a journaled vote is always applied.
+    if (!reserve_vote()) return false;
+    if (!vote_log_append(&journal, LOG_VOTE, &record, sizeof(vote_record), timer_get_ticks())) return false;
+    apply_vote(&record);
 
-    printf("new vote: %d", vote_iter);
+    printf("new vote: %d", (int) vote_iter);
 
     return true;
 }
 
+static void replay_record(uint16_t type, const void * payload, size_t len, void * ctx) {
+    if (type == LOG_TICKET && len == sizeof(ticket_record)) {
+        apply_ticket(payload);
+    } else if (type == LOG_VOTE && len == sizeof(vote_record)) {
+        apply_vote(payload);
+    }
+}
+
+#define used_words(roster) (((roster) + 31) / 32)
+
+// Writes the whole election to the next snapshot device, then empties the
+// journal, which the snapshot now covers
+static bool save_snapshot(void) {
+    if (!vote_log_commit(&journal)) return false;
+
+    election_state state = {
+        tickets.max_tickets, tickets.capacity, tickets.num_tickets, vote_iter, nonce, MERKLE_CANDIDATES
+    };
+    size_t num = tickets.num_tickets;
+    size_t num_blocks = (vote_iter + LEAF_BLOCK_SIZE - 1) / LEAF_BLOCK_SIZE;
+    snapshot_section * sections = malloc((6 + num_blocks + MERKLE_MAX_HEIGHT + 1) * sizeof(snapshot_section));
+    if (sections == NULL) return false;
+    snapshot_section fixed[6] = {
+        { &state, sizeof(state) },
+        { tickets.slots, tickets.capacity * sizeof(uint32_t) },
+        { tickets.hashes, num * 32 },
+        { tickets.profiles, num * sizeof(keystroke_profile) },
+        { tickets.names, num * TICKET_NAME_SIZE },
+        { tickets.used, used_words(tickets.max_tickets) * sizeof(uint32_t) },
+    };
+    memcpy(sections, fixed, sizeof(fixed));
+    size_t num_sections = 6;
+    // Leaves block by block, the last one only as far as it's filled
+    for (size_t block = 0; block < num_blocks; block++) {
+        size_t count = vote_iter - block * LEAF_BLOCK_SIZE;
+        sections[num_sections].data = vote_leafs.blocks[block];
+        sections[num_sections++].len = (count < LEAF_BLOCK_SIZE ? count : LEAF_BLOCK_SIZE) * sizeof(leaf);
+    }
+    for (unsigned int level = 0; level <= vote_merkle_tree->height; level++) {
+        sections[num_sections].data = vote_merkle_tree->levels[level];
+        sections[num_sections++].len = merkle_row_size(vote_merkle_tree, level) * NODE_SIZE;
+    }
+
+    bool saved = snapshot_save(&snapshot_devices[snapshot_slot], journal.next_seq, sections, num_sections);
+    free(sections);
+    if (!saved) return false;
+    snapshot_seq = journal.next_seq;
+    snapshot_slot ^= 1;
+    return vote_log_reset(&journal);
+}
+
+// Loads the newest intact snapshot that fits this build, and returns the
+// journal record to replay from, 0 if there's none
+static uint64_t load_snapshot(void) {
+    snapshot_header headers[2];
+    int newest = -1;
+    for (int i = 0; i < 2; i++) {
+        if (snapshot_check(&snapshot_devices[i], &headers[i]) && (newest == -1 || headers[i].seq > headers[newest].seq)) {
+            newest = i;
+        }
+    }
+    if (newest == -1) return 0;
+
+    log_device * device = &snapshot_devices[newest];
+    size_t offset = 0;
+    election_state state;
+    if (!snapshot_read(device, &offset, &state, sizeof(state))) return 0;
+    if (state.max_tickets != tickets.max_tickets || state.capacity != tickets.capacity ||
+        state.num_tickets > state.max_tickets || state.candidates != MERKLE_CANDIDATES) {
+        printf("snapshot doesn't fit this build, ignoring it\n");
+        return 0;
+    }
+
+    // The header's checksum covered every byte, so only the length can
+    // still disagree with the state
+    vote_merkle * tree = alloc_merkle_tree(state.num_votes);
+    size_t num = state.num_tickets;
+    size_t length = sizeof(state) + state.capacity * sizeof(uint32_t) +
+                    num * (32 + sizeof(keystroke_profile) + TICKET_NAME_SIZE) +
+                    used_words(state.max_tickets) * sizeof(uint32_t) + state.num_votes * sizeof(leaf);
+    for (unsigned int level = 0; level <= tree->height; level++) {
+        length += merkle_row_size(tree, level) * NODE_SIZE;
+    }
+    if (length != headers[newest].length || !leaf_store_reserve(&vote_leafs, state.num_votes)) {
+        free_merkle_tree(tree);
+        return 0;
+    }
+
+    snapshot_read(device, &offset, tickets.slots, state.capacity * sizeof(uint32_t));
+    snapshot_read(device, &offset, tickets.hashes, num * 32);
+    snapshot_read(device, &offset, tickets.profiles, num * sizeof(keystroke_profile));
+    snapshot_read(device, &offset, tickets.names, num * TICKET_NAME_SIZE);
+    snapshot_read(device, &offset, tickets.used, used_words(state.max_tickets) * sizeof(uint32_t));
+    for (size_t first = 0; first < state.num_votes; first += LEAF_BLOCK_SIZE) {
+        size_t count = state.num_votes - first < LEAF_BLOCK_SIZE ? state.num_votes - first : LEAF_BLOCK_SIZE;
+        snapshot_read(device, &offset, leaf_store_get(&vote_leafs, first), count * sizeof(leaf));
+    }
+    vote_leafs.num_leafs = state.num_votes;
+    for (unsigned int level = 0; level <= tree->height; level++) {
+        snapshot_read(device, &offset, tree->levels[level], merkle_row_size(tree, level) * NODE_SIZE);
+    }
+    tickets.num_tickets = num;
+    vote_iter = state.num_votes;
+    nonce = state.nonce;
+    vote_merkle_tree = tree;
+
+    snapshot_seq = headers[newest].seq;
+    snapshot_slot = newest ^ 1;
+    return snapshot_seq;
+}
+
+static void open_device(log_device * device, const char * path) {
+#ifdef VOTE_LOG_FILE
+    if (log_file_device(device, path)) return;
+    printf("cannot open %s, keeping it in memory\n", path);
+#endif
+    // No storage driver on the board yet, so on the Pi nothing survives a
+    // reset
+    log_memory_device(device);
+}
+
+// Loads the latest snapshot and replays the journal after it, so restarting
+// costs at most SNAPSHOT_INTERVAL records of replay. Returns false if the
+// election can't be restored whole.
+static bool recover_election(void) {
+    open_device(&journal_device, VOTE_LOG_PATH);
+    open_device(&snapshot_devices[0], VOTE_SNAPSHOT_PATH ".0");
+    open_device(&snapshot_devices[1], VOTE_SNAPSHOT_PATH ".1");
+    vote_log_config config;
+    vote_log_default_config(&config);
+    vote_log_open(&journal, &journal_device, &config);
+
+    uint64_t first_seq = load_snapshot();
+    if (vote_merkle_tree == NULL) vote_merkle_tree = create_merkle_tree(NULL, 0);
+    cert_index_init(&vote_certs);
+    for (size_t i = 0; i < vote_iter; i++) {
+        if (!cert_index_add(&vote_certs, (char *) get_merkle_node(vote_merkle_tree, 0, i))) {
+            printf("no memory for the certificate index\n");
+            return false;
+        }
+    }
+
+    if (!vote_log_recover(&journal, first_seq, replay_record, NULL)) {
+        printf("journal starts after the last usable snapshot\n");
+        return false;
+    }
+    size_t replayed = journal.next_seq - first_seq;
+    if (first_seq || replayed) printf("restored %d votes, replayed %d journal records\n", (int) vote_iter, (int) replayed);
+    return true;
+}
+
 /*
  * Init and store control flow
  */
 void init_voting(void) {
-    vote_merkle_tree = malloc(8);
+    arena_init(&request_arena, REQUEST_ARENA_SIZE);
+    ticket_store_init(&tickets, MAX_TICKET);
+    leaf_store_init(&vote_leafs);
+    keystroke_default_config(&keystroke_settings);
+    // Votes the journal still holds would be lost by starting without them
+    if (!recover_election()) {
+        printf("not starting\n");
+        return;
+    }
 
     interrupts_init();
     screen_init();
@@ -507,6 +798,11 @@ void init_voting(void) {
 
     while (1)
     {
+        // Sync journal records that have waited out the commit window, and
+        // snapshot between screens once enough have built up
+        vote_log_poll(&journal, timer_get_ticks());
+        if (journal.next_seq - snapshot_seq >= SNAPSHOT_INTERVAL) save_snapshot();
+
         switch (get_selected_screen()) {
             case AdminLogin:
                 handle_admin_auth_screen();
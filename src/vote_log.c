@@ -0,0 +1,343 @@
+#ifdef VOTE_LOG_FILE
+#define _POSIX_C_SOURCE 200809L // pread, ftruncate and fsync
+#endif
+
+#include "vote_log.h"
+#include "strings.h"
+#include "malloc.h"
+
+#define padded_length(len) (((len) + 3) & ~(size_t) 3)
+
+// CRC-32 (IEEE), table built on first use
+static uint32_t crc_table[256];
+static bool crc_table_ready = false;
+
+static void init_crc_table(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (crc & 1 ? 0xedb88320 : 0);
+        }
+        crc_table[i] = crc;
+    }
+    crc_table_ready = true;
+}
+
+static uint32_t crc32_update(uint32_t crc, const void * data, size_t len) {
+    const unsigned char * bytes = data;
+    for (size_t i = 0; i < len; i++) {
+        crc = crc_table[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+// Covers everything after the checksum field, padding included
+static uint32_t record_checksum(const vote_log_record * header, const void * payload) {
+    if (!crc_table_ready) init_crc_table();
+    uint32_t crc = crc32_update(0xffffffff, (const char *) header + sizeof(header->checksum),
+                                sizeof(vote_log_record) - sizeof(header->checksum));
+    return ~crc32_update(crc, payload, padded_length(header->length));
+}
+
+void vote_log_default_config(vote_log_config * config) {
+    config->window_us = VOTE_LOG_WINDOW_US;
+    config->batch_size = VOTE_LOG_BATCH_SIZE;
+}
+
+bool vote_log_open(vote_log * log, log_device * device, const vote_log_config * config) {
+    log->device = device;
+    log->config = *config;
+    // Room for one more record past batch_size, so a record always fits
+    // after a commit
+    log->batch = malloc(config->batch_size + sizeof(vote_log_record) + VOTE_LOG_MAX_PAYLOAD);
+    log->batch_len = 0;
+    log->batch_start = 0;
+    log->next_seq = 0;
+    log->durable_seq = 0;
+    log->size = 0;
+    log->syncs = 0;
+    return log->batch != NULL;
+}
+
+bool vote_log_recover(vote_log * log, uint64_t first_seq, void (*apply)(uint16_t type, const void * payload, size_t len, void * ctx), void * ctx) {
+    log_device * device = log->device;
+    char payload[VOTE_LOG_MAX_PAYLOAD];
+    size_t offset = 0;
+    uint64_t seq = 0;
+
+    while (1) {
+        vote_log_record header;
+        if (device->read(device, offset, &header, sizeof(header)) != sizeof(header)) break;
+        if (header.length > VOTE_LOG_MAX_PAYLOAD) break;
+
+        size_t length = padded_length(header.length);
+        if (device->read(device, offset + sizeof(header), payload, length) != length) break;
+        if (record_checksum(&header, payload) != header.checksum) break;
+
+        // The device starts wherever it was last reset. Past first_seq, the
+        // records in between are gone and the rest can't be applied, but
+        // they're still durable so the device is left as it is.
+        if (offset == 0) {
+            if (header.seq > first_seq) return false;
+            seq = header.seq;
+        }
+        if (header.seq != seq) break;
+
+        if (seq >= first_seq) apply(header.type, payload, header.length, ctx);
+        offset += sizeof(header) + length;
+        seq++;
+    }
+
+    // Whatever follows the last intact record was never committed
+    device->truncate(device, offset);
+    log->size = offset;
+    log->next_seq = seq > first_seq ? seq : first_seq;
+    log->durable_seq = log->next_seq;
+    log->batch_len = 0;
+    return true;
+}
+
+bool vote_log_commit(vote_log * log) {
+    if (log->batch_len == 0) return true;
+
+    log_device * device = log->device;
+    if (!device->write(device, log->batch, log->batch_len) || !device->sync(device)) {
+        // Drop a partial write so a retry doesn't leave a torn record
+        // before good ones
+        device->truncate(device, log->size);
+        return false;
+    }
+    log->size += log->batch_len;
+    log->batch_len = 0;
+    log->durable_seq = log->next_seq;
+    log->syncs++;
+    return true;
+}
+
+bool vote_log_append(vote_log * log, uint16_t type, const void * payload, size_t len, unsigned int now) {
+    if (len > VOTE_LOG_MAX_PAYLOAD) return false;
+
+    size_t record_size = sizeof(vote_log_record) + padded_length(len);
+    if (log->batch_len + record_size > log->config.batch_size && !vote_log_commit(log)) return false;
+    if (log->batch_len == 0) log->batch_start = now;
+
+    char * record = log->batch + log->batch_len;
+    vote_log_record header;
+    header.type = type;
+    header.length = len;
+    header.seq = log->next_seq;
+    memcpy(record + sizeof(header), payload, len);
+    memset(record + sizeof(header) + len, 0, padded_length(len) - len);
+    header.checksum = record_checksum(&header, record + sizeof(header));
+    memcpy(record, &header, sizeof(header));
+    log->batch_len += record_size;
+    log->next_seq++;
+
+    if (log->batch_len >= log->config.batch_size || now - log->batch_start >= log->config.window_us) {
+        if (vote_log_commit(log)) return true;
+        // The caller treats this record as rejected, so it mustn't go out
+        // with the next commit
+        log->batch_len -= record_size;
+        log->next_seq--;
+        return false;
+    }
+    return true;
+}
+
+bool vote_log_poll(vote_log * log, unsigned int now) {
+    if (log->batch_len == 0 || now - log->batch_start < log->config.window_us) return true;
+    return vote_log_commit(log);
+}
+
+bool vote_log_reset(vote_log * log) {
+    if (!vote_log_commit(log)) return false;
+
+    log_device * device = log->device;
+    if (!device->truncate(device, 0) || !device->sync(device)) return false;
+    log->size = 0;
+    return true;
+}
+
+void vote_log_close(vote_log * log) {
+    vote_log_commit(log);
+    free(log->batch);
+    log->batch = NULL;
+}
+
+/*
+ * Snapshots
+ */
+bool snapshot_save(log_device * device, uint64_t seq, const snapshot_section * sections, size_t num_sections) {
+    if (!crc_table_ready) init_crc_table();
+    snapshot_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.seq = seq;
+
+    uint32_t crc = 0xffffffff;
+    for (size_t i = 0; i < num_sections; i++) {
+        crc = crc32_update(crc, sections[i].data, sections[i].len);
+        header.length += sections[i].len;
+    }
+    header.checksum = ~crc;
+
+    if (!device->truncate(device, 0)) return false;
+    if (!device->write(device, &header, sizeof(header))) return false;
+    for (size_t i = 0; i < num_sections; i++) {
+        if (sections[i].len && !device->write(device, sections[i].data, sections[i].len)) return false;
+    }
+    return device->sync(device);
+}
+
+bool snapshot_check(log_device * device, snapshot_header * header) {
+    if (device->read(device, 0, header, sizeof(snapshot_header)) != sizeof(snapshot_header)) return false;
+    for (size_t i = 0; i < sizeof(header->magic); i++) {
+        if (header->magic[i] != SNAPSHOT_MAGIC[i]) return false;
+    }
+    if (header->version != SNAPSHOT_VERSION) return false;
+
+    if (!crc_table_ready) init_crc_table();
+    char chunk[256];
+    uint32_t crc = 0xffffffff;
+    for (uint64_t done = 0; done < header->length;) {
+        size_t len = header->length - done < sizeof(chunk) ? header->length - done : sizeof(chunk);
+        if (device->read(device, sizeof(snapshot_header) + done, chunk, len) != len) return false;
+        crc = crc32_update(crc, chunk, len);
+        done += len;
+    }
+    return ~crc == header->checksum;
+}
+
+bool snapshot_read(log_device * device, size_t * offset, void * buf, size_t len) {
+    if (device->read(device, sizeof(snapshot_header) + *offset, buf, len) != len) return false;
+    *offset += len;
+    return true;
+}
+
+/*
+ * Memory device
+ */
+typedef struct {
+    char * data;
+    size_t size;
+    size_t capacity;
+} memory_log;
+
+static bool memory_write(log_device * dev, const void * data, size_t len) {
+    memory_log * mem = dev->ctx;
+    if (mem->size + len > mem->capacity) {
+        size_t capacity = mem->capacity ? mem->capacity : 4096;
+        while (capacity < mem->size + len) capacity *= 2;
+        char * grown = realloc(mem->data, capacity);
+        if (grown == NULL) return false;
+        mem->data = grown;
+        mem->capacity = capacity;
+    }
+    memcpy(mem->data + mem->size, data, len);
+    mem->size += len;
+    return true;
+}
+
+static bool memory_sync(log_device * dev) {
+    return true;
+}
+
+static size_t memory_read(log_device * dev, size_t offset, void * buf, size_t len) {
+    memory_log * mem = dev->ctx;
+    if (offset >= mem->size) return 0;
+    if (len > mem->size - offset) len = mem->size - offset;
+    memcpy(buf, mem->data + offset, len);
+    return len;
+}
+
+static bool memory_truncate(log_device * dev, size_t size) {
+    memory_log * mem = dev->ctx;
+    if (size < mem->size) mem->size = size;
+    return true;
+}
+
+static void memory_close(log_device * dev) {
+    memory_log * mem = dev->ctx;
+    free(mem->data);
+    free(mem);
+}
+
+bool log_memory_device(log_device * device) {
+    memory_log * mem = malloc(sizeof(memory_log));
+    if (mem == NULL) return false;
+    mem->data = NULL;
+    mem->size = 0;
+    mem->capacity = 0;
+
+    device->write = memory_write;
+    device->sync = memory_sync;
+    device->read = memory_read;
+    device->truncate = memory_truncate;
+    device->close = memory_close;
+    device->ctx = mem;
+    return true;
+}
+
+/*
+ * File device
+ */
+#ifdef VOTE_LOG_FILE
+#include <fcntl.h>
+#include <unistd.h>
+
+static bool file_write(log_device * dev, const void * data, size_t len) {
+    int fd = *(int *) dev->ctx;
+    const char * bytes = data;
+    while (len > 0) {
+        ssize_t written = write(fd, bytes, len);
+        if (written <= 0) return false;
+        bytes += written;
+        len -= written;
+    }
+    return true;
+}
+
+static bool file_sync(log_device * dev) {
+    return fsync(*(int *) dev->ctx) == 0;
+}
+
+static size_t file_read(log_device * dev, size_t offset, void * buf, size_t len) {
+    int fd = *(int *) dev->ctx;
+    size_t done = 0;
+    while (done < len) {
+        ssize_t got = pread(fd, (char *) buf + done, len - done, offset + done);
+        if (got <= 0) break;
+        done += got;
+    }
+    return done;
+}
+
+static bool file_truncate(log_device * dev, size_t size) {
+    return ftruncate(*(int *) dev->ctx, size) == 0;
+}
+
+static void file_close(log_device * dev) {
+    close(*(int *) dev->ctx);
+    free(dev->ctx);
+}
+
+bool log_file_device(log_device * device, const char * path) {
+    int * fd = malloc(sizeof(int));
+    if (fd == NULL) return false;
+    // O_APPEND keeps writes at the end after a truncate
+    *fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (*fd < 0) {
+        free(fd);
+        return false;
+    }
+
+    device->write = file_write;
+    device->sync = file_sync;
+    device->read = file_read;
+    device->truncate = file_truncate;
+    device->close = file_close;
+    device->ctx = fd;
+    return true;
+}
+#endif
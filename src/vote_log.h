@@ -0,0 +1,131 @@
+#ifndef VOTE_LOG_H
+#define VOTE_LOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Append-only journal of the election. Each record is a header and a
+ * payload the caller defines, checksummed and numbered so recovery stops
+ * at the first torn or corrupt record. Records are buffered and written in
+ * batches with one sync per batch (group commit). A record is durable once
+ * the batch it's in has been committed.
+ */
+
+#define VOTE_LOG_MAX_PAYLOAD 512
+
+// Defaults for vote_log_config, override with -D
+#ifndef VOTE_LOG_WINDOW_US
+#define VOTE_LOG_WINDOW_US 200000 // Longest a record waits to be synced
+#endif
+#ifndef VOTE_LOG_BATCH_SIZE
+#define VOTE_LOG_BATCH_SIZE 4096 // Bytes buffered before a commit is forced
+#endif
+
+// Storage the log is written to. Data is only appended, and truncated when
+// recovery finds a torn tail.
+typedef struct log_device {
+    bool (*write)(struct log_device * dev, const void * data, size_t len);
+    bool (*sync)(struct log_device * dev); // Makes everything written durable
+    size_t (*read)(struct log_device * dev, size_t offset, void * buf, size_t len);
+    bool (*truncate)(struct log_device * dev, size_t size);
+    void (*close)(struct log_device * dev);
+    void * ctx;
+} log_device;
+
+// Integers are little-endian, as on the Pi and x86 hosts
+typedef struct {
+    uint32_t checksum; // CRC-32 of the rest of the header and the payload
+    uint16_t type;
+    uint16_t length; // Payload bytes, the record is padded to a multiple of 4
+    uint64_t seq; // Records are numbered from 0 with no gaps
+} vote_log_record;
+
+typedef struct {
+    unsigned int window_us; // 0 syncs every record
+    size_t batch_size;
+} vote_log_config;
+
+typedef struct {
+    log_device * device;
+    vote_log_config config;
+    char * batch; // Records not written yet
+    size_t batch_len;
+    unsigned int batch_start; // Time the oldest record in batch was appended
+    uint64_t next_seq;
+    uint64_t durable_seq; // Records below this have been synced
+    size_t size; // Bytes on the device
+    size_t syncs;
+} vote_log;
+
+void vote_log_default_config(vote_log_config * config);
+
+bool vote_log_open(vote_log * log, log_device * device, const vote_log_config * config);
+
+// Calls apply for every intact record on the device from first_seq on, in
+// order, and drops anything after the last one. Earlier records are
+// skipped, they're already in the snapshot taken at first_seq. Returns
+// false, without applying or dropping anything, if the device starts after
+// first_seq.
+bool vote_log_recover(vote_log * log, uint64_t first_seq, void (*apply)(uint16_t type, const void * payload, size_t len, void * ctx), void * ctx);
+
+// Buffers a record, committing the batch if it's full or the oldest record
+// in it has waited window_us. now is in microseconds. Returns false if the
+// record can't be stored, and then it's dropped from the batch.
+bool vote_log_append(vote_log * log, uint16_t type, const void * payload, size_t len, unsigned int now);
+
+// Commits the batch if its oldest record has waited window_us
+bool vote_log_poll(vote_log * log, unsigned int now);
+
+// Writes and syncs every buffered record
+bool vote_log_commit(vote_log * log);
+
+// Commits and then empties the device, numbering carries on from next_seq.
+// Only call once a snapshot covering every record is durable.
+bool vote_log_reset(vote_log * log);
+
+void vote_log_close(vote_log * log);
+
+/*
+ * Snapshots. A snapshot replaces a device's contents with a header and the
+ * caller's sections back to back. It holds the state after journal records
+ * below seq, so recovery loads it and replays the journal from seq.
+ * Snapshots alternate between two devices, so a crash while writing one
+ * leaves the other intact.
+ */
+#define SNAPSHOT_MAGIC "VSNAP"
+#define SNAPSHOT_VERSION 1
+
+typedef struct {
+    char magic[6];
+    uint16_t version;
+    uint64_t seq;
+    uint64_t length; // Payload bytes after the header
+    uint32_t checksum; // CRC-32 of the payload
+    uint32_t reserved;
+} snapshot_header;
+
+typedef struct {
+    const void * data;
+    size_t len;
+} snapshot_section;
+
+// Writes and syncs a snapshot, returns false if it isn't durable
+bool snapshot_save(log_device * device, uint64_t seq, const snapshot_section * sections, size_t num_sections);
+
+// Checks the device holds a complete snapshot and fills in its header
+bool snapshot_check(log_device * device, snapshot_header * header);
+
+// Reads the next len payload bytes, offset starts at 0 and is advanced
+bool snapshot_read(log_device * device, size_t * offset, void * buf, size_t len);
+
+// Device kept in RAM, for boards without storage
+bool log_memory_device(log_device * device);
+
+#ifdef VOTE_LOG_FILE
+// Device backed by a file, created if missing
+bool log_file_device(log_device * device, const char * path);
+#endif
+
+#endif